@@ -4,6 +4,7 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "esp_err.h"
 #include "audiomatrix_types.h"
 #include "audiomatrix_event_types.h"
 
@@ -12,8 +13,12 @@ extern "C" {
 #endif
 device_t * getDevice();
 BaseType_t setDefaultPreferences();
+BaseType_t getHaMQTTOutputConfigTopic(uint8_t num, uint8_t class, char *topic, size_t topicSize);
+size_t getHaMQTTDeviceDiscovery(char *topic, size_t topicSize, char *payload, size_t payloadSize);
 BaseType_t getHaMQTTOutputConfig(uint8_t num, uint8_t class, char *topic, size_t topicSize, char *payload, size_t payloadSize);
 BaseType_t getHaMQTTDeviceState(char *topic, size_t topicSize, char *payload, size_t payloadSize);
+BaseType_t getHaMQTTOutputState(uint8_t num, char *topic, size_t topicSize, char *payload, size_t payloadSize);
+BaseType_t getHaMQTTStatusTopic(char *topic, size_t topicSize);
 BaseType_t getHaMQTTStateTopic(char *topic, size_t topicSize);
 BaseType_t setHaMQTTOutput(char *topic, size_t topicSize, char *payload, size_t payloadSize);
 void sendOutputToDispaly();
@@ -22,7 +27,16 @@ const char * getDeviceState();
 
 BaseType_t saveConfig(device_t *pdevice);
 BaseType_t savePort(uint8_t numOutput, uint8_t numInput);
+BaseType_t savePorts(const int16_t *inputs);
 
+deviceSnapshot_t * deviceSnapshotAcquire(void);
+void deviceSnapshotRetain(deviceSnapshot_t *snapshot);
+void deviceSnapshotRelease(deviceSnapshot_t *snapshot);
+esp_err_t audiomatrixEventHandlerRegisterNamed(audiomatrix_event_t event_id, esp_event_handler_t handler, void *arg, const char *name);
+#define audiomatrixEventHandlerRegister(event_id, handler, arg) \
+    audiomatrixEventHandlerRegisterNamed(event_id, handler, arg, __FILE__ ":" #handler)
+
+BaseType_t audiomatrixRestore(void);
 void audiomatrixInit(void);
 
 #ifdef __cplusplus
@@ -10,7 +10,8 @@ extern "C" {
 
 typedef enum {
     AUDIOMATRIX_EVENT_PORT_CHANGED = 0,
-    AUDIOMATRIX_EVENT_CONFIG_CHANGED
+    AUDIOMATRIX_EVENT_CONFIG_CHANGED,
+    AUDIOMATRIX_EVENT_PORTS_CHANGED
 } audiomatrix_event_t;
 
 ESP_EVENT_DECLARE_BASE(AUDIOMATRIX_EVENT);
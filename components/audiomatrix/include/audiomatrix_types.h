@@ -3,6 +3,7 @@
 #define __AUDIOMATRIX_TYPES_H__
 
 #include <stdint.h>
+#include <stdatomic.h>
 #include "audiomatrix_event_types.h"
 
 #ifdef __cplusplus
@@ -21,7 +22,7 @@ typedef struct {
     uint8_t num;
     char name[16]; // from param
     char formatedName[16]; // by name
-    char shortName[4]; // from param
+    char shortName[9]; // from param, 4 cyrillic letters in UTF-8
     char longName[32]; // from param
 } input_t;
 
@@ -31,11 +32,12 @@ typedef struct {
     uint8_t num;
     char name[16]; // from param english name
     char formatedName[16]; // by name
-    char shortName[4]; // from param short cyrillic name
+    char shortName[9]; // from param short cyrillic name, 4 letters in UTF-8
     char longName[32]; // from param long cyrillic name
 	char objectId[49]; // by device.name+object.name "sublightkitchen_do_not_disturb" 
     char uniqueId[40]; // device.identifier+object_class+object.name "0xa4c138fe6784_switch_do_not_disturb_z2mone" 
 	char commandTopic[76]; // by param + "/set/out%d" "myhome/audioamatrix2/set/out1"
+    char stateTopic[76]; // by param + "/out%d" "myhome/audioamatrix2/out1"
     uint8_t inputPort;
 } output_t;
 
@@ -56,6 +58,24 @@ typedef struct {
     char hassTopic[64]; // "/homeassistant"
 } device_t;
 
+// AUDIOMATRIX_EVENT_PORT_CHANGED data
+typedef struct {
+    uint8_t output;
+    uint8_t inputPort;
+} audiomatrixPortChange_t;
+
+// AUDIOMATRIX_EVENT_PORTS_CHANGED data: several outputs switched with one latch
+typedef struct {
+    uint32_t outputs;   // bit n set if output n changed
+} audiomatrixPortsChange_t;
+
+// AUDIOMATRIX_EVENT_CONFIG_CHANGED data: immutable device config shared by all
+// subscribers, freed by the last deviceSnapshotRelease()
+typedef struct {
+    atomic_int refs;
+    device_t device;
+} deviceSnapshot_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,8 +1,13 @@
 #include <string.h>
+#include <stdlib.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "esp_attr.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
 #include "home_wifi.h"
 #include "lwip/err.h"
 #include "lwip/sys.h"
@@ -18,17 +23,100 @@
 static const char *TAG = "audiomatrix";
 
 #define NVSGROUP "device"
-#define ONAME "out%d"
+#define OPREFIX "out"
+#define ONAME OPREFIX "%d"
 #define INAME "in%d"
 #define STATE_TEMPLATE "{{ value_json.state }}"
 #define OUTPUT_STATE_TEMPLATE "{{ value_json.out%d }}"
+#define OUTPUT_TOPIC_TEMPLATE "{% set x = value | int %}"
 #define MUTEX_TAKE_TICK_PERIOD 1000 / portTICK_PERIOD_MS
+#define LATCH_WAIT_TICK_PERIOD 100 / portTICK_PERIOD_MS
+#define RELAY_OUTPUTS_PER_WORD 4
+#define RELAY_CHAIN_LENGTH ((OUT_PORTS + RELAY_OUTPUTS_PER_WORD - 1) / RELAY_OUTPUTS_PER_WORD)
+#define RTC_ROUTING_MAGIC 0x414D5254 // "AMRT"
+#define SUBSCRIBERS_MAX 8
+#define COMMAND_TOPICS_MAX (OUT_PORTS + 4)
+#define COMMAND_BUCKETS 128
+#define INPUT_NAMES_MAX (IN_PORTS * 3)
+#define INPUT_NAME_BUCKETS 128
+#define NO_COMMAND 0xFF
+#define BATCH_PAYLOAD_MAX 512
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+_Static_assert(OUT_PORTS <= 32, "changed outputs are a 32 bit mask");
+_Static_assert(COMMAND_BUCKETS >= 2 * COMMAND_TOPICS_MAX, "command buckets too few for the outputs");
+_Static_assert(INPUT_NAME_BUCKETS >= 2 * INPUT_NAMES_MAX, "input name buckets too few for the inputs");
+_Static_assert(CONFIG_EVENTS_POST_PENDING >= OUT_PORTS, "CONFIG_EVENTS_POST_PENDING below the output count, port changes would spill out of the coalesce window");
 ESP_EVENT_DEFINE_BASE(AUDIOMATRIX_EVENT);
+_Static_assert(RELAY_CHAIN_LENGTH <= CONFIG_RELAY_CHAIN_MAX, "Relay chain is longer than RELAY_CHAIN_MAX");
+
+// Routing vector retained in RTC slow memory across software resets
+typedef struct {
+    uint32_t magic;
+    uint8_t inputPorts[OUT_PORTS];
+    uint32_t crc;
+} rtcRouting_t;
 
 static SemaphoreHandle_t xMutex;
 
 static device_t device;
 static nvs_handle_t pHandle = 0;
+static RTC_NOINIT_ATTR rtcRouting_t rtcRouting;
+static bool relayReady = false;
+static portMUX_TYPE latchLock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t latchTimeUs = -1; // time from reset to the first relay latch, under latchLock
+static SemaphoreHandle_t latchSemaphore = NULL; // given by the SPI ISR on the first latch
+static bool restoredFromRtc = false;
+
+typedef struct {
+    int32_t event_id;
+    eventsNestedHandle_t handle;   // handler and its own dispatch profile
+} subscriber_t;
+
+static subscriber_t subscribers[SUBSCRIBERS_MAX];
+static uint8_t subscribersCount = 0;
+static deviceSnapshot_t *deviceSnapshot = NULL; // latest config, holds one reference
+static portMUX_TYPE snapshotLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Inbound MQTT commands: topic hashes and input names are indexed at configure time,
+// so a command resolves with one hash and one compare whatever the number of outputs.
+typedef BaseType_t (*commandHandler_t)(uint8_t num, const char *payload, size_t payloadSize);
+
+#define COMMAND_TOPIC_SIZE sizeof(device.outputs[0].commandTopic)
+#define INPUT_NAME_SIZE sizeof(device.inputs[0].longName)
+_Static_assert(COMMAND_TOPIC_SIZE >= sizeof(device.stateTopic) + 4, "command topic too short for \"<state topic>/set\"");
+
+typedef struct {
+    uint32_t hash;
+    char topic[COMMAND_TOPIC_SIZE];
+    size_t topicLen;
+    commandHandler_t handler;
+    uint8_t num;
+} commandTopic_t;
+
+typedef struct {
+    uint32_t hash;
+    char name[INPUT_NAME_SIZE];
+    size_t nameLen;
+    uint8_t input;
+} inputName_t;
+
+// The index keeps copies of the topics and names, the config they come from
+// is rewritten while commands arrive
+typedef struct {
+    commandTopic_t topics[COMMAND_TOPICS_MAX];
+    uint8_t countTopics;
+    uint8_t topicBuckets[COMMAND_BUCKETS];
+    inputName_t names[INPUT_NAMES_MAX];
+    uint8_t countNames;
+    uint8_t nameBuckets[INPUT_NAME_BUCKETS];
+} commandIndex_t;
+
+// Configure builds the spare index outside commandLock and swaps it in,
+// lookups read the active index under commandLock
+static commandIndex_t commandIndexes[2];
+static uint8_t activeCommandIndex = 0;
+static portMUX_TYPE commandLock = portMUX_INITIALIZER_UNLOCKED;
 
 static const char *outputClass[3] = {"disable", "switch", "select"};
 
@@ -67,40 +155,139 @@ static BaseType_t getDeviceId(char *deviceId){
     return ret;
 }
 
+/// @brief Copy the first chars UTF-8 characters of a string
+static void utf8CopyChars(char *out, const char *in, size_t outSize, uint8_t chars)
+{
+    size_t len = 0;
+    while (in[len] && chars) {
+        size_t next = len + 1;
+        while ((in[next] & 0xC0) == 0x80) next++;
+        if (next >= outSize)
+            break;
+        len = next;
+        chars--;
+    }
+    memcpy(out, in, len);
+    out[len] = '\0';
+}
+
+static void sendOutputItemToDisplay(uint8_t num, bool highlight)
+{
+    // Both names share one layout item with the separator, longer names are cut
+    // on a character boundary so the input stays visible
+    const uint8_t nameChars = (LCD_LAYOUT_ITEM_WIDTH - 1) / 2;
+    char output[sizeof(device.outputs[0].shortName)], input[sizeof(device.inputs[0].shortName)];
+    char item[sizeof(output) + sizeof(input)];
+    utf8CopyChars(output, device.outputs[num].shortName, sizeof(output), nameChars);
+    utf8CopyChars(input, device.inputs[device.outputs[num].inputPort].shortName, sizeof(input), nameChars);
+    snprintf(item, sizeof(item), "%s:%s", output, input);
+    lcdLayoutSetItem(num, item, highlight);
+}
+
 void sendOutputToDispaly()
 {
+    // The layout pages through the outputs that do not fit on the screen
     for (uint8_t num = 0; num < OUT_PORTS; num++) {
-        char line[9];
-        sprintf(line, "%s:%s ", device.outputs[num].shortName, device.inputs[device.outputs[num].inputPort].shortName);
-        lcdSetCursor((num%2)*8, num/2);
-        lcdWriteStr(line);
+        sendOutputItemToDisplay(num, false);
     }
+    lcdLayoutShow(OUT_PORTS);
 }
 
-static void sendOutputToMatrix()
+static uint32_t rtcRoutingCrc(const rtcRouting_t *routing)
 {
-    uint16_t shift = 0;
-    uint8_t nums[] = {1,0,3,2};
+    return esp_rom_crc32_le(0, routing->inputPorts, sizeof(routing->inputPorts));
+}
+
+static void rtcRoutingSave()
+{
+    rtcRouting.magic = RTC_ROUTING_MAGIC;
+    for (uint8_t num = 0; num < OUT_PORTS; num++) {
+        rtcRouting.inputPorts[num] = device.outputs[num].inputPort;
+    }
+    rtcRouting.crc = rtcRoutingCrc(&rtcRouting);
+}
 
-    for (uint8_t i = 0; i < sizeof(nums); i++) {
-        uint8_t num = nums[i];
-        shift <<= 4;
+static BaseType_t rtcRoutingValid()
+{
+    switch (esp_reset_reason()) {
+        case ESP_RST_SW:
+        case ESP_RST_PANIC:
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT:
+        case ESP_RST_DEEPSLEEP:
+            break;
+        default:
+            return pdFALSE; // cold boot: RTC memory content is undefined
+    }
+    if (rtcRouting.magic != RTC_ROUTING_MAGIC || rtcRouting.crc != rtcRoutingCrc(&rtcRouting))
+        return pdFALSE;
+    for (uint8_t num = 0; num < OUT_PORTS; num++) {
+        if (rtcRouting.inputPorts[num] >= IN_PORTS)
+            return pdFALSE;
+    }
+    return pdTRUE;
+}
+
+/// @brief Build the shift register chain, 4 relays per output, 4 outputs per register.
+/// words[0] is the register nearest to the MCU.
+static void getMatrixWords(uint16_t *words)
+{
+    memset(words, 0, RELAY_CHAIN_LENGTH * sizeof(*words));
+    for (uint8_t num = 0; num < OUT_PORTS; num++) {
+        uint16_t nibble;
         switch (device.outputs[num].inputPort) {
             case 0: 
-                if (num == 0) shift |= 0b0000; else shift |= 0b0101;
+                if (num == 0) nibble = 0b0000; else nibble = 0b0101;
                 break;
             case 1: 
-                if (num == 0) shift |= 0b0101; else shift |= 0b0000;
+                if (num == 0) nibble = 0b0101; else nibble = 0b0000;
                 break;
             case 2: 
-                shift |= 0b1111;
+                nibble = 0b1111;
                 break;
             default:
-            shift |= 0b0000;   
+                nibble = 0b0000;   
         }
+        // outputs are wired in the order 1,0,3,2 from the most significant nibble
+        uint8_t local = num % RELAY_OUTPUTS_PER_WORD;
+        words[num / RELAY_OUTPUTS_PER_WORD] |= nibble << ((3 - (local ^ 1)) * 4);
+    }
+    for (uint8_t i = 0; i < RELAY_CHAIN_LENGTH; i++) {
+        words[i] = ~words[i];
+    }
+}
+
+static void IRAM_ATTR matrixLatched(int64_t latchTime, void *arg)
+{
+    bool first = false;
+    taskENTER_CRITICAL_ISR(&latchLock);
+    if (latchTimeUs < 0) {
+        latchTimeUs = latchTime;
+        first = true;
     }
-    shift = ~shift;
-    sendToRelay(&shift, 1);
+    taskEXIT_CRITICAL_ISR(&latchLock);
+    if (first && latchSemaphore != NULL) {
+        BaseType_t woken = pdFALSE;
+        xSemaphoreGiveFromISR(latchSemaphore, &woken);
+        if (woken) portYIELD_FROM_ISR();
+    }
+}
+
+static int64_t getLatchTime()
+{
+    taskENTER_CRITICAL(&latchLock);
+    int64_t latchTime = latchTimeUs;
+    taskEXIT_CRITICAL(&latchLock);
+    return latchTime;
+}
+
+static void sendOutputToMatrix()
+{
+    uint16_t words[RELAY_CHAIN_LENGTH];
+    getMatrixWords(words);
+    sendToRelayAsync(words, RELAY_CHAIN_LENGTH, matrixLatched, NULL);
+    rtcRoutingSave();
 }
 
 static void inputConfigure(uint8_t num)
@@ -146,11 +333,257 @@ static void outputConfigure(uint8_t num)
     // commandTopic
     snprintf(output->commandTopic, sizeof(output->commandTopic), 
         "%s/set/out%d", device.stateTopic, (int)num + 1);
+    // stateTopic
+    snprintf(output->stateTopic, sizeof(output->stateTopic), 
+        "%s/out%d", device.stateTopic, (int)num + 1);
     // Num input
     snprintf(key, sizeof(key), "out%d.input", (int)num + 1);
     getUInt8Pref(pHandle, key, &(output->inputPort));
 }
 
+void deviceSnapshotRetain(deviceSnapshot_t *snapshot)
+{
+    atomic_fetch_add(&snapshot->refs, 1);
+}
+
+void deviceSnapshotRelease(deviceSnapshot_t *snapshot)
+{
+    if (snapshot != NULL && atomic_fetch_sub(&snapshot->refs, 1) == 1)
+        free(snapshot);
+}
+
+/// @brief Latest device config, the caller owns a reference
+deviceSnapshot_t * deviceSnapshotAcquire(void)
+{
+    taskENTER_CRITICAL(&snapshotLock);
+    deviceSnapshot_t *snapshot = deviceSnapshot;
+    if (snapshot != NULL)
+        deviceSnapshotRetain(snapshot);
+    taskEXIT_CRITICAL(&snapshotLock);
+    return snapshot;
+}
+
+/// @brief Copy the device config once for every subscriber of the config event.
+/// @return snapshot with a reference for the event, NULL if out of memory
+static deviceSnapshot_t * deviceSnapshotPublish(void)
+{
+    deviceSnapshot_t *snapshot = malloc(sizeof(deviceSnapshot_t));
+    if (snapshot == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate device snapshot");
+        return NULL;
+    }
+    atomic_init(&snapshot->refs, 2); // the latest config and the event
+    memcpy(&snapshot->device, &device, sizeof(device));
+    taskENTER_CRITICAL(&snapshotLock);
+    deviceSnapshot_t *previous = deviceSnapshot;
+    deviceSnapshot = snapshot;
+    taskEXIT_CRITICAL(&snapshotLock);
+    deviceSnapshotRelease(previous);
+    return snapshot;
+}
+
+/// @brief The only esp_event handler of AUDIOMATRIX_EVENT: runs the subscribers in
+/// registration order, then drops the snapshot reference the config event carried.
+static void audiomatrixEventDispatch(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
+{
+    deviceSnapshot_t *snapshot = NULL;
+    if (event_id == AUDIOMATRIX_EVENT_CONFIG_CHANGED) {
+        snapshot = *(deviceSnapshot_t **)event_data;
+        event_data = snapshot;
+    }
+    for (uint8_t num = 0; num < subscribersCount; num++) {
+        if (subscribers[num].event_id == event_id)
+            eventsNestedHandlerCall(subscribers[num].handle, event_base, event_id, event_data);
+    }
+    deviceSnapshotRelease(snapshot);
+}
+
+/// @brief Subscribe to an audiomatrix event. Config event handlers get the
+/// deviceSnapshot_t, valid for the call or until their own deviceSnapshotRelease().
+/// Each subscriber has its own entry in the events dispatch profile.
+esp_err_t audiomatrixEventHandlerRegisterNamed(audiomatrix_event_t event_id, esp_event_handler_t handler, void *arg, const char *name)
+{
+    if (subscribersCount >= SUBSCRIBERS_MAX) {
+        ESP_LOGE(TAG, "Failed register handler of \"%s\" #%d", AUDIOMATRIX_EVENT, event_id);
+        return ESP_ERR_NO_MEM;
+    }
+    subscriber_t *subscriber = &subscribers[subscribersCount];
+    esp_err_t err = eventsNestedHandlerRegisterNamed(AUDIOMATRIX_EVENT, event_id, handler, arg, name, &subscriber->handle);
+    if (err != ESP_OK)
+        return err;
+    subscriber->event_id = event_id;
+    subscribersCount++;
+    return ESP_OK;
+}
+
+static uint32_t fnv1a(const char *str, size_t len)
+{
+    uint32_t hash = FNV_OFFSET;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)str[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static void commandTopicAdd(commandIndex_t *index, const char *topic, commandHandler_t handler, uint8_t num)
+{
+    if (index->countTopics >= COMMAND_TOPICS_MAX || strlen(topic) == 0)
+        return;
+    commandTopic_t *command = &index->topics[index->countTopics];
+    strlcpy(command->topic, topic, sizeof(command->topic));
+    command->topicLen = strlen(command->topic);
+    command->hash = fnv1a(command->topic, command->topicLen);
+    command->handler = handler;
+    command->num = num;
+    uint8_t bucket = command->hash & (COMMAND_BUCKETS - 1);
+    while (index->topicBuckets[bucket] != NO_COMMAND) {
+        bucket = (bucket + 1) & (COMMAND_BUCKETS - 1);
+    }
+    index->topicBuckets[bucket] = index->countTopics++;
+}
+
+static void inputNameAdd(commandIndex_t *index, const char *name, uint8_t input)
+{
+    if (index->countNames >= INPUT_NAMES_MAX || strlen(name) == 0)
+        return;
+    inputName_t *inputName = &index->names[index->countNames];
+    strlcpy(inputName->name, name, sizeof(inputName->name));
+    inputName->nameLen = strlen(inputName->name);
+    inputName->hash = fnv1a(inputName->name, inputName->nameLen);
+    inputName->input = input;
+    uint8_t bucket = inputName->hash & (INPUT_NAME_BUCKETS - 1);
+    while (index->nameBuckets[bucket] != NO_COMMAND) {
+        bucket = (bucket + 1) & (INPUT_NAME_BUCKETS - 1);
+    }
+    index->nameBuckets[bucket] = index->countNames++;
+}
+
+/// @brief Input of a command payload: its number or any of its names
+/// @return input number, -1 if unknown
+static int16_t commandInput(const char *payload, size_t payloadSize)
+{
+    if (payloadSize > 0 && payloadSize <= 3) {
+        int16_t input = 0;
+        size_t i = 0;
+        for (; i < payloadSize && payload[i] >= '0' && payload[i] <= '9'; i++) {
+            input = input * 10 + payload[i] - '0';
+        }
+        if (i == payloadSize)
+            return input < IN_PORTS ? input : -1;
+    }
+    uint32_t hash = fnv1a(payload, payloadSize);
+    int16_t input = -1;
+    taskENTER_CRITICAL(&commandLock);
+    const commandIndex_t *index = &commandIndexes[activeCommandIndex];
+    uint8_t bucket = hash & (INPUT_NAME_BUCKETS - 1);
+    for (uint8_t num; index->countNames && (num = index->nameBuckets[bucket]) != NO_COMMAND; bucket = (bucket + 1) & (INPUT_NAME_BUCKETS - 1)) {
+        const inputName_t *inputName = &index->names[num];
+        if (inputName->hash == hash && inputName->nameLen == payloadSize && memcmp(inputName->name, payload, payloadSize) == 0) {
+            input = inputName->input;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&commandLock);
+    return input;
+}
+
+static BaseType_t outputCommand(uint8_t num, const char *payload, size_t payloadSize)
+{
+    int16_t input = commandInput(payload, payloadSize);
+    if (input < 0) {
+        ESP_LOGW(TAG, "Unknown input \"%.*s\" for the output %d", (int)payloadSize, payload, (int)num + 1);
+        return pdFALSE;
+    }
+    return savePort(num, input);
+}
+
+/// @brief Output of a batch command key: "out" and the output number in plain decimal
+/// @return output index, -1 if the key is not an output
+static int16_t batchOutput(const char *key)
+{
+    if (strncmp(key, OPREFIX, sizeof(OPREFIX) - 1) != 0)
+        return -1;
+    const char *digit = key + sizeof(OPREFIX) - 1;
+    // No sign, space or leading zero
+    if (*digit < '1' || *digit > '9')
+        return -1;
+    int16_t output = 0;
+    for (; *digit != '\0'; digit++) {
+        if (*digit < '0' || *digit > '9' || output > OUT_PORTS)
+            return -1;
+        output = output * 10 + *digit - '0';
+    }
+    return output <= OUT_PORTS ? output - 1 : -1;
+}
+
+/// @brief Batch command {"out1":2,"out3":"Name"}: applied with one latch,
+/// or not at all if any member is invalid
+static BaseType_t batchCommand(uint8_t num, const char *payload, size_t payloadSize)
+{
+    if (payloadSize > BATCH_PAYLOAD_MAX) {
+        ESP_LOGW(TAG, "Batch command of %u bytes is too large", (unsigned)payloadSize);
+        return pdFALSE;
+    }
+    int16_t inputs[OUT_PORTS];
+    for (uint8_t out = 0; out < OUT_PORTS; out++) {
+        inputs[out] = -1;
+    }
+    BaseType_t valid = pdFALSE, changed = pdFALSE;
+    cJSON *root = cJSON_ParseWithLength(payload, payloadSize);
+    if (cJSON_IsObject(root)) {
+        valid = pdTRUE;
+        cJSON *member;
+        cJSON_ArrayForEach(member, root) {
+            int16_t output = batchOutput(member->string);
+            int16_t input = -1;
+            if (cJSON_IsString(member))
+                input = commandInput(member->valuestring, strlen(member->valuestring));
+            else if (cJSON_IsNumber(member) && member->valuedouble >= 0 && member->valuedouble < IN_PORTS
+                && member->valuedouble == member->valueint)
+                input = member->valueint;
+            if (output < 0 || input < 0) {
+                valid = pdFALSE;
+                break;
+            }
+            inputs[output] = input;
+            changed = pdTRUE;
+        }
+    }
+    cJSON_Delete(root);
+    if (valid != pdTRUE) {
+        ESP_LOGW(TAG, "Invalid batch command \"%.*s\"", (int)payloadSize, payload);
+        return pdFALSE;
+    }
+    return changed == pdTRUE ? savePorts(inputs) : pdTRUE;
+}
+
+/// @brief Index the command topics and input names of the current config,
+/// the caller holds xMutex
+static void commandTopicsConfigure()
+{
+    // Only configure swaps the indexes, lookups never touch the spare one
+    commandIndex_t *index = &commandIndexes[activeCommandIndex ^ 1];
+    index->countTopics = 0;
+    memset(index->topicBuckets, NO_COMMAND, sizeof(index->topicBuckets));
+    for (uint8_t num = 0; num < OUT_PORTS; num++) {
+        commandTopicAdd(index, device.outputs[num].commandTopic, outputCommand, num);
+    }
+    char batchTopic[COMMAND_TOPIC_SIZE];    // "<state topic>/set"
+    snprintf(batchTopic, sizeof(batchTopic), "%s/set", device.stateTopic);
+    commandTopicAdd(index, batchTopic, batchCommand, 0);
+    index->countNames = 0;
+    memset(index->nameBuckets, NO_COMMAND, sizeof(index->nameBuckets));
+    for (uint8_t num = 0; num < IN_PORTS; num++) {
+        inputNameAdd(index, device.inputs[num].longName, num);
+        inputNameAdd(index, device.inputs[num].name, num);
+        inputNameAdd(index, device.inputs[num].shortName, num);
+    }
+    taskENTER_CRITICAL(&commandLock);
+    activeCommandIndex ^= 1;
+    taskEXIT_CRITICAL(&commandLock);
+}
+
 static BaseType_t deviceConfigure()
 {    
     ESP_LOGI(TAG, "Setting device config...");
@@ -183,6 +616,7 @@ static BaseType_t deviceConfigure()
         outputConfigure(num);
     }
     nvs_close(pHandle);
+    commandTopicsConfigure();
     xSemaphoreGive(xMutex);
 
     sendOutputToMatrix();
@@ -190,9 +624,14 @@ static BaseType_t deviceConfigure()
     ESP_LOGI(TAG, "Device config complite");
 
     ESP_LOGI(TAG, "Posting event \"%s\" #%d:device config changed...", AUDIOMATRIX_EVENT, AUDIOMATRIX_EVENT_CONFIG_CHANGED);
-    esp_err_t err = esp_event_post(AUDIOMATRIX_EVENT, AUDIOMATRIX_EVENT_CONFIG_CHANGED, &device, sizeof(device), portMAX_DELAY);
+    // Only the snapshot pointer is copied into the event loop
+    deviceSnapshot_t *snapshot = deviceSnapshotPublish();
+    if (snapshot == NULL)
+        return pdTRUE;
+    esp_err_t err = eventsPost(AUDIOMATRIX_EVENT, AUDIOMATRIX_EVENT_CONFIG_CHANGED, &snapshot, sizeof(snapshot), EVENTS_POST_TICKS);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to post event to \"%s\" #%d: %d (%s)", AUDIOMATRIX_EVENT, AUDIOMATRIX_EVENT_PORT_CHANGED, err, esp_err_to_name(err));
+        ESP_LOGE(TAG, "Failed to post event to \"%s\" #%d: %d (%s)", AUDIOMATRIX_EVENT, AUDIOMATRIX_EVENT_CONFIG_CHANGED, err, esp_err_to_name(err));
+        deviceSnapshotRelease(snapshot);
     };
     return pdTRUE;
 }
@@ -254,8 +693,12 @@ static BaseType_t setPort(uint8_t numOutput, uint8_t numInput)
     output_t *output = &(device.outputs[numOutput]);
     output->inputPort = numInput;
     sendOutputToMatrix();
-    sendOutputToDispaly();
-    esp_err_t err = esp_event_post(AUDIOMATRIX_EVENT, AUDIOMATRIX_EVENT_PORT_CHANGED, &output, sizeof(output), portMAX_DELAY);
+    sendOutputItemToDisplay(numOutput, true);
+    audiomatrixPortChange_t change = {
+        .output = numOutput,
+        .inputPort = numInput
+    };
+    esp_err_t err = eventsPost(AUDIOMATRIX_EVENT, AUDIOMATRIX_EVENT_PORT_CHANGED, &change, sizeof(change), EVENTS_POST_TICKS);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to post event to \"%s\" #%d: %d (%s)", AUDIOMATRIX_EVENT, AUDIOMATRIX_EVENT_PORT_CHANGED, err, esp_err_to_name(err));
     };
@@ -283,6 +726,51 @@ BaseType_t savePort(uint8_t numOutput, uint8_t numInput)
     return pdTRUE;
 }
 
+/// @brief Switch several outputs with one NVS session, one relay latch and one event
+/// @param inputs input of every output, -1 keeps the output
+/// @return pdTRUE if OK else pdFALSE
+BaseType_t savePorts(const int16_t *inputs)
+{
+    uint32_t changed = 0;
+    if(xSemaphoreTake( xMutex, MUTEX_TAKE_TICK_PERIOD ) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed save input ports");
+        return pdFALSE;
+    }
+    if(nvsOpen(NVSGROUP, NVS_READWRITE, &pHandle) != pdTRUE) {
+        xSemaphoreGive(xMutex);
+        return pdFALSE;
+    }
+    for (uint8_t num = 0; num < OUT_PORTS; num++) {
+        if (inputs[num] < 0 || inputs[num] >= IN_PORTS || inputs[num] == device.outputs[num].inputPort)
+            continue;
+        char key[16];
+        snprintf(key, sizeof(key), "out%d.input", (int)num + 1);
+        setUInt8Pref(pHandle, key, inputs[num]);
+        changed |= 1u << num;
+    }
+    nvs_close(pHandle);
+    xSemaphoreGive(xMutex);
+    if (changed == 0)
+        return pdTRUE;
+
+    for (uint8_t num = 0; num < OUT_PORTS; num++) {
+        if (changed & (1u << num)) {
+            device.outputs[num].inputPort = inputs[num];
+            sendOutputItemToDisplay(num, true);
+        }
+    }
+    sendOutputToMatrix();
+    audiomatrixPortsChange_t change = {
+        .outputs = changed
+    };
+    esp_err_t err = eventsPost(AUDIOMATRIX_EVENT, AUDIOMATRIX_EVENT_PORTS_CHANGED, &change, sizeof(change), EVENTS_POST_TICKS);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to post event to \"%s\" #%d: %d (%s)", AUDIOMATRIX_EVENT, AUDIOMATRIX_EVENT_PORTS_CHANGED, err, esp_err_to_name(err));
+    };
+    ESP_LOGI(TAG, "Output ports 0x%08lx switched with one latch", changed);
+    return pdTRUE;
+}
+
 BaseType_t setDefaultPreferences() 
 {
     ESP_LOGI(TAG, "Setting default preference of device");
@@ -398,11 +886,53 @@ BaseType_t getHaMQTTStateTopic(char *topic, size_t topicSize)
     return pdTRUE;
 }
 
-BaseType_t getHaMQTTOutputConfig(uint8_t num, uint8_t class, char *topic, size_t topicSize, char *payload, size_t payloadSize)
+/// @brief Topic of the Home Assistant birth and last will messages
+BaseType_t getHaMQTTStatusTopic(char *topic, size_t topicSize)
 {
-    output_t *output = &(device.outputs[num]);
+    strlcpy(topic, device.hassTopic, topicSize);
+    strlcat(topic, "/status", topicSize);
+    return pdTRUE;
+}
 
-    // topic
+#define SELECT_TEMPLATE_SIZE (100 + (sizeof(((input_t*)0)->longName) + 16) * IN_PORTS)
+
+/// @brief value_template of a select: input number of the state to the input long name
+static void selectStateTemplate(uint8_t num, char *stateTemplate, size_t stateTemplateSize)
+{
+    strlcpy(stateTemplate, "{% set mapper = {", stateTemplateSize);
+    for (uint8_t inum = 0; inum < IN_PORTS; inum++) {
+        char option[sizeof(((input_t*)0)->longName) + 16];
+        snprintf(option, sizeof(option), "%d:'%s',", inum, device.inputs[inum].longName);
+        strlcat(stateTemplate, option, stateTemplateSize);
+    }
+    strlcat(stateTemplate, "} %}", stateTemplateSize);
+#if CONFIG_AM_MQTT_OUTPUT_STATE_TOPICS
+    strlcat(stateTemplate, OUTPUT_TOPIC_TEMPLATE, stateTemplateSize);
+#else
+    char setx[34];
+    snprintf(setx, sizeof(setx), "{%% set x = value_json.out%d %%}", (int)num + 1);
+    strlcat(stateTemplate, setx, stateTemplateSize);
+#endif
+    strlcat(stateTemplate, "{{ mapper[x] if x in mapper else 'Failed' }}", stateTemplateSize);
+}
+
+/// @brief command_template of a select: input long name to the input number
+static void selectCommandTemplate(char *commandTemplate, size_t commandTemplateSize)
+{
+    strlcpy(commandTemplate, "{% set mapper = {", commandTemplateSize);
+    for (uint8_t inum = 0; inum < IN_PORTS; inum++) {
+        char option[sizeof(((input_t*)0)->longName) + 16];
+        snprintf(option, sizeof(option), "'%s':%d,", device.inputs[inum].longName, inum);
+        strlcat(commandTemplate, option, commandTemplateSize);
+    }
+    strlcat(commandTemplate, "} %}", commandTemplateSize);
+    strlcat(commandTemplate, "{{ mapper[value] if value in mapper else 'Failed' }}", commandTemplateSize);
+}
+
+/// @brief Discovery topic of an output entity of the class
+BaseType_t getHaMQTTOutputConfigTopic(uint8_t num, uint8_t class, char *topic, size_t topicSize)
+{
+    output_t *output = &(device.outputs[num]);
     strlcpy(topic, device.hassTopic, topicSize);
     strlcat(topic, "/", topicSize);
     strlcat(topic, outputClass[class], topicSize);
@@ -413,6 +943,15 @@ BaseType_t getHaMQTTOutputConfig(uint8_t num, uint8_t class, char *topic, size_t
     strlcat(topic, "_", topicSize);
     strlcat(topic, output->formatedName, topicSize);
     strlcat(topic, "/config", topicSize);
+    return pdTRUE;
+}
+
+BaseType_t getHaMQTTOutputConfig(uint8_t num, uint8_t class, char *topic, size_t topicSize, char *payload, size_t payloadSize)
+{
+    output_t *output = &(device.outputs[num]);
+
+    // topic
+    getHaMQTTOutputConfigTopic(num, class, topic, topicSize);
     
     if (output->class != class){
         strlcpy(payload, "", payloadSize);
@@ -448,45 +987,31 @@ BaseType_t getHaMQTTOutputConfig(uint8_t num, uint8_t class, char *topic, size_t
     cJSON_AddStringToObject(root, "unique_id", output->uniqueId);
     cJSON_AddStringToObject(root, "icon", "mdi:volume-source");
     cJSON_AddStringToObject(root, "command_topic", output->commandTopic);
+#if CONFIG_AM_MQTT_OUTPUT_STATE_TOPICS
+    cJSON_AddStringToObject(root, "state_topic", output->stateTopic);
+#else
     cJSON_AddStringToObject(root, "state_topic", device.stateTopic);
+#endif
     if (output->class == CLASS_SWITCH) {
         cJSON_AddNumberToObject(root, "payload_off", 1);
         cJSON_AddNumberToObject(root, "payload_on", 0);
+        // An output topic holds the bare input number, only the aggregated state needs a template
+#if !CONFIG_AM_MQTT_OUTPUT_STATE_TOPICS
         char stateTemplate[24];
         snprintf(stateTemplate, sizeof(stateTemplate), OUTPUT_STATE_TEMPLATE, (int)num + 1);
         cJSON_AddStringToObject(root, "value_template", stateTemplate);
+#endif
     }
     if (output->class == CLASS_SELECT) {
         json_options = cJSON_AddArrayToObject(root, "options");
         for (uint8_t inum = 0; inum < IN_PORTS; inum++) {
             cJSON_AddStringToObject(json_options, "", device.inputs[inum].longName);
         }
-        // value_template
-        char stateTemplate[100 + (sizeof(((input_t*)0)->longName) + 16) * IN_PORTS];
-        strlcpy(stateTemplate, "{% set mapper = {", sizeof(stateTemplate));
-        for (uint8_t inum = 0; inum < IN_PORTS; inum++) {
-            char option[sizeof(((input_t*)0)->longName) + 16];
-            snprintf(option, sizeof(option), "%d:'%s',", inum, device.inputs[inum].longName);
-            strlcat(stateTemplate, option, sizeof(stateTemplate));
-        }
-        strlcat(stateTemplate, "} %}", sizeof(stateTemplate));
-        char setx[34];
-        snprintf(setx, sizeof(setx), "{%% set x = value_json.out%d %%}", (int)num + 1);
-        strlcat(stateTemplate, setx, sizeof(stateTemplate));
-        strlcat(stateTemplate, "{{ mapper[x] if x in mapper else 'Failed' }}", sizeof(stateTemplate));
+        char stateTemplate[SELECT_TEMPLATE_SIZE];
+        selectStateTemplate(num, stateTemplate, sizeof(stateTemplate));
         cJSON_AddStringToObject(root, "value_template", stateTemplate);
-        // command_tempalate
-        char commandTemplate[100 + (sizeof(((input_t*)0)->longName) + 16) * IN_PORTS];
-        strlcpy(commandTemplate, "{% set mapper = {", sizeof(commandTemplate));
-        for (uint8_t inum = 0; inum < IN_PORTS; inum++) {
-            char option[sizeof(((input_t*)0)->longName) + 16];
-            snprintf(option, sizeof(option), "'%s':%d,", device.inputs[inum].longName, inum);
-            strlcat(commandTemplate, option, sizeof(commandTemplate));
-        }
-        strlcat(commandTemplate, "} %}", sizeof(commandTemplate));
-        //strlcat(commandTemplate, "{% set x = {{option}} %}", sizeof(commandTemplate));
-        strlcat(commandTemplate, "{{ mapper[value] if value in mapper else 'Failed' }}", sizeof(commandTemplate));
-        //strlcat(commandTemplate, "{{ value }}", sizeof(commandTemplate));
+        char commandTemplate[SELECT_TEMPLATE_SIZE];
+        selectCommandTemplate(commandTemplate, sizeof(commandTemplate));
         cJSON_AddStringToObject(root, "command_template", commandTemplate);
     }
     
@@ -501,6 +1026,162 @@ BaseType_t getHaMQTTOutputConfig(uint8_t num, uint8_t class, char *topic, size_t
     cJSON_Delete(root);
     return result;
 }
+// Writer of JSON straight into a caller buffer. len counts the whole document even
+// if it does not fit, like snprintf(), so a NULL buffer measures it.
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    char last;
+} jsonWriter_t;
+
+static void jsonPutChar(jsonWriter_t *w, char c)
+{
+    if (w->len + 1 < w->size) {
+        w->buf[w->len] = c;
+        w->buf[w->len + 1] = '\0';
+    }
+    w->len++;
+    w->last = c;
+}
+
+static void jsonPutRaw(jsonWriter_t *w, const char *str)
+{
+    while (*str)
+        jsonPutChar(w, *str++);
+}
+
+static void jsonPutString(jsonWriter_t *w, const char *str)
+{
+    jsonPutChar(w, '"');
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            jsonPutChar(w, '\\');
+        if ((uint8_t)*str >= 0x20)
+            jsonPutChar(w, *str);
+    }
+    jsonPutChar(w, '"');
+}
+
+/// @brief Separator and key of the next member, key NULL for an array item
+static void jsonPutKey(jsonWriter_t *w, const char *key)
+{
+    if (w->last != '{' && w->last != '[')
+        jsonPutChar(w, ',');
+    if (key != NULL) {
+        jsonPutString(w, key);
+        jsonPutChar(w, ':');
+    }
+}
+
+static void jsonPutMember(jsonWriter_t *w, const char *key, const char *value)
+{
+    jsonPutKey(w, key);
+    jsonPutString(w, value);
+}
+
+/// @brief Device-based discovery of all outputs in one message with abbreviated keys.
+/// Classes an output does not use are sent with the platform only, which removes them.
+/// @param payload caller buffer, NULL to measure
+/// @return length of the payload without the terminating zero
+size_t getHaMQTTDeviceDiscovery(char *topic, size_t topicSize, char *payload, size_t payloadSize)
+{
+    snprintf(topic, topicSize, "%s/device/%s/config", device.hassTopic, device.identifier);
+    jsonWriter_t w = {
+        .buf = payload,
+        .size = payload ? payloadSize : 0,
+        .len = 0,
+        .last = '{'
+    };
+    if (payload && payloadSize)
+        payload[0] = '\0';
+    char configurationUrl[64];
+    getConfigurationUrl(configurationUrl, sizeof(configurationUrl));
+
+    jsonPutChar(&w, '{');
+    jsonPutKey(&w, "dev");
+    jsonPutChar(&w, '{');
+    jsonPutKey(&w, "ids");
+    jsonPutChar(&w, '[');
+    jsonPutMember(&w, NULL, device.identifier);
+    jsonPutChar(&w, ']');
+    jsonPutMember(&w, "name", device.name);
+    jsonPutMember(&w, "mf", device.manufacturer);
+    jsonPutMember(&w, "mdl", device.model);
+    jsonPutMember(&w, "mdl_id", device.modelId);
+    jsonPutMember(&w, "hw", device.hwVersion);
+    jsonPutMember(&w, "sw", device.swVersion);
+    jsonPutMember(&w, "cu", configurationUrl);
+    jsonPutChar(&w, '}');
+    jsonPutKey(&w, "o");
+    jsonPutChar(&w, '{');
+    jsonPutMember(&w, "name", device.model);
+    jsonPutMember(&w, "sw", device.swVersion);
+    jsonPutChar(&w, '}');
+    // Topics of the components start with the state topic
+    jsonPutMember(&w, "~", device.stateTopic);
+    jsonPutMember(&w, "avty_t", "~");
+    jsonPutMember(&w, "avty_tpl", STATE_TEMPLATE);
+    jsonPutKey(&w, "cmps");
+    jsonPutChar(&w, '{');
+    for (uint8_t num = 0; num < OUT_PORTS; num++) {
+        output_t *output = &(device.outputs[num]);
+        char value[SELECT_TEMPLATE_SIZE];
+        for (uint8_t class = CLASS_SWITCH; class <= CLASS_SELECT; class++) {
+            if (output->class != class) {
+                snprintf(value, sizeof(value), "%s_%s_%s", device.identifier, outputClass[class], output->formatedName);
+                jsonPutKey(&w, value);
+                jsonPutChar(&w, '{');
+                jsonPutMember(&w, "p", outputClass[class]);
+                jsonPutChar(&w, '}');
+            }
+        }
+        if (output->class == CLASS_DISABLE)
+            continue;
+        jsonPutKey(&w, output->uniqueId);
+        jsonPutChar(&w, '{');
+        jsonPutMember(&w, "p", outputClass[output->class]);
+        jsonPutMember(&w, "name", output->name);
+        jsonPutMember(&w, "def_ent_id", output->objectId);
+        jsonPutMember(&w, "uniq_id", output->uniqueId);
+        jsonPutMember(&w, "ic", "mdi:volume-source");
+        snprintf(value, sizeof(value), "~/set/" ONAME, (int)num + 1);
+        jsonPutMember(&w, "cmd_t", value);
+#if CONFIG_AM_MQTT_OUTPUT_STATE_TOPICS
+        snprintf(value, sizeof(value), "~/" ONAME, (int)num + 1);
+        jsonPutMember(&w, "stat_t", value);
+#else
+        jsonPutMember(&w, "stat_t", "~");
+#endif
+        if (output->class == CLASS_SWITCH) {
+            jsonPutKey(&w, "pl_off");
+            jsonPutRaw(&w, "1");
+            jsonPutKey(&w, "pl_on");
+            jsonPutRaw(&w, "0");
+#if !CONFIG_AM_MQTT_OUTPUT_STATE_TOPICS
+            snprintf(value, sizeof(value), OUTPUT_STATE_TEMPLATE, (int)num + 1);
+            jsonPutMember(&w, "val_tpl", value);
+#endif
+        }
+        if (output->class == CLASS_SELECT) {
+            jsonPutKey(&w, "ops");
+            jsonPutChar(&w, '[');
+            for (uint8_t inum = 0; inum < IN_PORTS; inum++) {
+                jsonPutMember(&w, NULL, device.inputs[inum].longName);
+            }
+            jsonPutChar(&w, ']');
+            selectStateTemplate(num, value, sizeof(value));
+            jsonPutMember(&w, "val_tpl", value);
+            selectCommandTemplate(value, sizeof(value));
+            jsonPutMember(&w, "cmd_tpl", value);
+        }
+        jsonPutChar(&w, '}');
+    }
+    jsonPutChar(&w, '}');
+    jsonPutChar(&w, '}');
+    return w.len;
+}
+
 /// @brief 
 /// @param topic 
 /// @param topicSize 
@@ -522,7 +1203,21 @@ BaseType_t getHaMQTTDeviceState(char *topic, size_t topicSize, char *payload, si
     return result;
 }
 
-/// @brief Set the outgoing port to match the incoming port according to MQTT data
+/// @brief State of one output for its own retained topic, the payload is the input number
+/// @param num output number
+/// @return pdTRUE if OK else pdFALSE
+BaseType_t getHaMQTTOutputState(uint8_t num, char *topic, size_t topicSize, char *payload, size_t payloadSize)
+{
+    if (num >= OUT_PORTS)
+        return pdFALSE;
+    output_t *output = &(device.outputs[num]);
+    strlcpy(topic, output->stateTopic, topicSize);
+    snprintf(payload, payloadSize, "%d", (int)output->inputPort);
+    return pdTRUE;
+}
+
+/// @brief Dispatch an MQTT command by its topic. An output command takes the input
+/// number or any name of the input.
 /// @param topic 
 /// @param topicSize 
 /// @param payload 
@@ -530,18 +1225,52 @@ BaseType_t getHaMQTTDeviceState(char *topic, size_t topicSize, char *payload, si
 /// @return pdTRUE if OK else pdFALSE
 BaseType_t setHaMQTTOutput(char *topic, size_t topicSize, char *payload, size_t payloadSize)
 {
-    int8_t numOutput = -1;
-    for(uint8_t num = 0; num < OUT_PORTS; num++){
-        output_t *output = &(device.outputs[num]);
-        if (strncmp(output->commandTopic, topic, topicSize) == 0){
-            numOutput = num;
+    uint32_t hash = fnv1a(topic, topicSize);
+    commandHandler_t handler = NULL;
+    uint8_t num = 0;
+    taskENTER_CRITICAL(&commandLock);
+    const commandIndex_t *index = &commandIndexes[activeCommandIndex];
+    uint8_t bucket = hash & (COMMAND_BUCKETS - 1);
+    for (uint8_t slot; index->countTopics && (slot = index->topicBuckets[bucket]) != NO_COMMAND; bucket = (bucket + 1) & (COMMAND_BUCKETS - 1)) {
+        const commandTopic_t *command = &index->topics[slot];
+        if (command->hash == hash && command->topicLen == topicSize && memcmp(command->topic, topic, topicSize) == 0) {
+            handler = command->handler;
+            num = command->num;
+            break;
         }
     }
-    if (numOutput >= 0 && payloadSize == 1 && payload[0] >= 48 && payload[0] < 48 + IN_PORTS) {       
-        savePort(numOutput, payload[0] - 48);
-        return pdTRUE;
+    taskEXIT_CRITICAL(&commandLock);
+    if (handler == NULL)
+        return pdFALSE;
+    return handler(num, payload, payloadSize);
+}
+
+/// @brief Latch the routing retained in RTC memory on warm restarts
+/// @return pdTRUE if the relays were restored else pdFALSE
+BaseType_t audiomatrixRestore(void)
+{
+    if (!relayReady) {
+        matrixRelayInit();
+        relayReady = true;
+    }
+    if (rtcRoutingValid() != pdTRUE) {
+        ESP_LOGI(TAG, "No retained routing, relays will be restored from NVS");
+        return pdFALSE;
+    }
+    for (uint8_t num = 0; num < OUT_PORTS; num++) {
+        device.outputs[num].inputPort = rtcRouting.inputPorts[num];
     }
-    return pdFALSE;
+    // Polling fast path: nothing else is on the bus this early
+    uint16_t words[RELAY_CHAIN_LENGTH];
+    getMatrixWords(words);
+    sendToRelayPolling(words, RELAY_CHAIN_LENGTH);
+    int64_t latchTime = esp_timer_get_time();
+    taskENTER_CRITICAL(&latchLock);
+    latchTimeUs = latchTime;
+    taskEXIT_CRITICAL(&latchLock);
+    restoredFromRtc = true;
+    ESP_LOGI(TAG, "Relays latched %lld us after reset (rtc)", latchTime);
+    return pdTRUE;
 }
 
 /// @brief Audiomatrix initialization
@@ -556,10 +1285,17 @@ void audiomatrixInit(void)
     */
     
     onboardledInit();
-    matrixRelayInit();
+    if (!relayReady) {
+        matrixRelayInit();
+        relayReady = true;
+    }
+    matrixRelayWearInit();
 
     static StaticSemaphore_t xSemaphoreBuffer;
     xMutex = xSemaphoreCreateMutexStatic(&xSemaphoreBuffer);
+    static StaticSemaphore_t xLatchSemaphoreBuffer;
+    latchSemaphore = xSemaphoreCreateBinaryStatic(&xLatchSemaphoreBuffer);
+    ESP_ERROR_CHECK(eventsHandlerRegister(AUDIOMATRIX_EVENT, ESP_EVENT_ANY_ID, &audiomatrixEventDispatch, NULL));
 
     if(nvsOpen(NVSGROUP, NVS_READONLY, &pHandle) != pdTRUE ) {
         ESP_LOGW(TAG, "Namespace 'device' notfound");
@@ -574,13 +1310,26 @@ void audiomatrixInit(void)
         nvs_close(pHandle);
         deviceConfigure();
     }
+    // The routing frame is queued, it latches later from the SPI ISR
+    if (!restoredFromRtc) {
+        if (xSemaphoreTake(latchSemaphore, LATCH_WAIT_TICK_PERIOD) == pdTRUE)
+            ESP_LOGI(TAG, "Relays latched %lld us after reset (nvs)", getLatchTime());
+        else
+            ESP_LOGW(TAG, "Relays not latched yet");
+    }
+
+#if CONFIG_RELAY_BENCHMARK
+    uint16_t words[RELAY_CHAIN_LENGTH];
+    getMatrixWords(words);
+    matrixRelayBenchmark(words, RELAY_CHAIN_LENGTH, 100);
+#endif
 
     led_strip_collor_t color = {
         .red = 0,
         .green = 16,
         .blue = 0
     };
-    esp_err_t err = esp_event_post(ONBOARDLED_EVENT, ONBOARDLED_EVENT_SETCOLOR, &color, sizeof(color), portMAX_DELAY);
+    esp_err_t err = eventsPost(ONBOARDLED_EVENT, ONBOARDLED_EVENT_SETCOLOR, &color, sizeof(color), EVENTS_POST_TICKS);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to post event to \"%s\" #%d: %d (%s)", ONBOARDLED_EVENT, ONBOARDLED_EVENT_SETCOLOR, err, esp_err_to_name(err));
     };
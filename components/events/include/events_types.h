@@ -2,6 +2,7 @@
 #ifndef __EVENTS_TYPES_H__
 #define __EVENTS_TYPES_H__
 
+#include "sdkconfig.h"
 #include "esp_event.h"
 #include "esp_wifi_types.h"
 #include "esp_netif_types.h"
@@ -15,44 +16,92 @@
 extern "C" {
 #endif
 
-typedef void* event_data_t;
+typedef enum {
+    EVENTS_LOOP_ROUTING = 0,    // routing and state changes, high priority
+    EVENTS_LOOP_HOUSEKEEPING,   // connectivity, LED and other background work
+    EVENTS_LOOPS
+} eventsLoopId_t;
 
-typedef void (*callbackHandler_t)(void* callback_handler_arg,
-    esp_event_base_t event_base,
-    int32_t event_id,
-    void* event_data);
+typedef struct {
+    uint32_t posted;
+    uint32_t dispatched;
+    uint32_t failed;            // posts rejected by a full loop queue
+    uint32_t depth;             // events waiting now
+    uint32_t maxDepth;
+    int64_t totalLatency;       // us from post to dispatch
+    int64_t maxLatency;
+} eventsLoopStats_t;
+
+typedef enum {
+    EVENTS_POST_BLOCK = 0,      // wait for the loop queue up to the policy timeout
+    EVENTS_POST_DROP_OLDEST,    // never wait, a full pending FIFO drops the oldest payload
+    EVENTS_POST_COALESCE        // never wait, replace the pending payload with the same key
+} eventsPostPolicy_t;
 
-typedef union eventsDataItem {
-    uint32_t val;
-    void *ptr;
-} eventsDataItem_t;
+typedef struct {
+    uint32_t posted;
+    uint32_t coalesced;         // replaced the payload of a pending event
+    uint32_t dropped;           // timed out or dropped as the oldest
+    uint32_t reposted;          // pending envelope posted again by the loop after a full queue
+    uint32_t pending;           // payloads waiting now
+    uint32_t maxPending;
+} eventsPostPolicyStats_t;
+
+typedef struct {
+    uint32_t posted;
+    uint32_t forwarded;         // passed on to the event loops by the drain task
+    uint32_t failed;            // event loop did not take the event
+    uint32_t overflow;          // ring full
+    uint32_t oversize;          // payload above CONFIG_EVENTS_ISR_SLOT_SIZE
+    uint32_t depth;             // events waiting now
+    uint32_t maxDepth;
+} eventsIsrRingStats_t;
 
+// Dispatch profile of a handler registered with eventsHandlerRegister(), times in us
 typedef struct {
-    bool data_allocated;
-    bool data_set;
-    esp_event_base_t event_base;
-    int32_t event_id;
-    eventsDataItem_t event_data;
-} eventsDataQueueItem_t;
-
-esp_err_t eventsCallbackHandlerRegister(esp_event_base_t event_base, int32_t event_id,
-    callbackHandler_t callback_handler, void* calback_handler_arg);
-
-esp_err_t eventsCallbackExec(esp_event_base_t event_base, int32_t event_id,
-    void* event_data);
-
-BaseType_t eventsDataQueuePost(esp_event_base_t event_base, int32_t event_id,
-    void* event_data, size_t event_data_size, TickType_t ticks_to_wait);
-
-BaseType_t eventsDataQueuePostFromISR(esp_event_base_t event_base, int32_t event_id,
-    void* event_data, size_t event_data_size, BaseType_t* task_unblocked);
-    
-BaseType_t eventsDataQueueGet(esp_event_base_t event_base, int32_t event_id,
-    event_data_t* event_data, TickType_t ticks_to_wait);
-
-BaseType_t eventsDataQueueGetFromISR(esp_event_base_t event_base, int32_t event_id,
-    event_data_t* event_data, BaseType_t *const pxHigherPriorityTaskWoken);
-    
+    uint32_t calls;
+    int64_t totalTime;          // handler execution
+    int64_t maxTime;
+    int64_t totalDelay;         // from post to the handler call
+    int64_t maxDelay;
+} eventsHandlerProfile_t;
+
+esp_err_t eventsHandlerRegisterNamed(esp_event_base_t event_base, int32_t event_id,
+    esp_event_handler_t event_handler, void* event_handler_arg, const char *name);
+
+#define eventsHandlerRegister(event_base, event_id, event_handler, event_handler_arg) \
+    eventsHandlerRegisterNamed(event_base, event_id, event_handler, event_handler_arg, __FILE__ ":" #event_handler)
+
+// Handler called by a component dispatcher, profiled on its own
+typedef struct eventsHandler *eventsNestedHandle_t;
+
+esp_err_t eventsNestedHandlerRegisterNamed(esp_event_base_t event_base, int32_t event_id,
+    esp_event_handler_t event_handler, void* event_handler_arg, const char *name, eventsNestedHandle_t *handle);
+
+void eventsNestedHandlerCall(eventsNestedHandle_t handle, esp_event_base_t event_base, int32_t event_id, void* event_data);
+
+esp_err_t eventsPost(esp_event_base_t event_base, int32_t event_id,
+    const void* event_data, size_t event_data_size, TickType_t ticks_to_wait);
+
+// Bounded wait of eventsPost() for events without a post policy
+#define EVENTS_POST_TICKS pdMS_TO_TICKS(CONFIG_EVENTS_POST_TIMEOUT)
+
+esp_err_t eventsPostPolicySet(esp_event_base_t event_base, int32_t event_id,
+    eventsPostPolicy_t policy, TickType_t timeout, size_t keySize);
+
+BaseType_t eventsPostPolicyStats(esp_event_base_t event_base, int32_t event_id, eventsPostPolicyStats_t *stats);
+
+BaseType_t eventsPostFromISR(esp_event_base_t event_base, int32_t event_id,
+    const void* event_data, size_t event_data_size, BaseType_t* task_unblocked);
+
+void eventsIsrRingStats(eventsIsrRingStats_t *stats);
+
+BaseType_t eventsLoopStats(eventsLoopId_t loopId, eventsLoopStats_t *stats);
+
+size_t eventsHandlerProfiles(eventsHandlerProfile_t *profiles, size_t size);
+
+const char * getJsonEventsProfile();
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,208 +1,752 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include <stdlib.h>
+#include <stdatomic.h>
 #include <string.h>
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "cJSON.h"
 #include "events.h"
 
 static const char *TAG = "events";
 
+#define NO_INDEX 0xFF
+#define HANDLERS_MAX CONFIG_EVENTS_HANDLERS_MAX
+#define POST_DATA_MAX CONFIG_EVENTS_SLOT_SIZE
+
+#define POST_POLICIES CONFIG_EVENTS_POST_POLICIES
+#define POST_PENDING CONFIG_EVENTS_POST_PENDING
+#define PENDING_TICKS pdMS_TO_TICKS(CONFIG_EVENTS_POST_TIMEOUT) // bound of a pending post wait
+
+// Event data as posted to the application loops, the post time gives the dispatch latency.
+// A pending envelope is the header alone, the first handler of the loop moves the oldest
+// payload of the post policy into the dispatch slot of the policy.
+typedef struct {
+    int64_t postTime;
+    size_t size;
+    uint32_t pending;   // post policy of a pending envelope, NO_INDEX otherwise
+    uint8_t data[];
+} eventsEnvelope_t;
+
+typedef struct {
+    int64_t postTime;
+    size_t size;
+    uint8_t data[POST_DATA_MAX] __attribute__((aligned(4)));
+} eventsPending_t;
+
+// Payloads of a drop-oldest or coalesce policy wait in a FIFO, every one of them
+// has exactly one pending envelope in the loop queue.
+typedef struct {
+    esp_event_base_t event_base;
+    int32_t event_id;
+    eventsPostPolicy_t policy;
+    TickType_t timeout;
+    size_t keySize;
+    uint8_t head;
+    uint8_t count;
+    uint8_t unposted;           // payloads whose pending envelope did not fit the loop queue
+    eventsPending_t pending[POST_PENDING];
+    uint8_t dispatch[POST_DATA_MAX] __attribute__((aligned(4)));   // payload the loop dispatches now
+    eventsPostPolicyStats_t stats;
+} eventsPostPolicyEntry_t;
+
+typedef struct {
+    esp_event_loop_handle_t handle;
+    eventsLoopStats_t stats;
+#if CONFIG_EVENTS_PROFILING
+    int64_t dispatchPostTime;   // post time of the event the loop task dispatches now
+#endif
+} eventsLoop_t;
+
+typedef struct eventsHandler {
+    esp_event_handler_t event_handler;
+    void* event_handler_arg;
+    esp_event_base_t event_base;
+    int32_t event_id;
+    const char *name;
+    eventsLoop_t *loop;
+    bool nested;                // called by a component dispatcher, not by the loop
+#if CONFIG_EVENTS_PROFILING
+    eventsHandlerProfile_t profile;
+#endif
+} eventsHandler_t;
+
+static eventsLoop_t eventsLoops[EVENTS_LOOPS];
+static eventsHandler_t eventsHandlers[HANDLERS_MAX];
+static uint8_t countEventsHandlers = 0;
+static portMUX_TYPE eventsLoopLock = portMUX_INITIALIZER_UNLOCKED;
+static eventsPostPolicyEntry_t postPolicies[POST_POLICIES];
+static uint8_t countPostPolicies = 0;
+static SemaphoreHandle_t pendingMutex = NULL;    // serializes posters of pending payloads
+static uint8_t unpostedTotal = 0;               // unposted pending envelopes of all policies
+
+#define ISR_RING_SIZE CONFIG_EVENTS_ISR_RING_SIZE
+#define ISR_RING_MASK (ISR_RING_SIZE - 1)
+#define ISR_SLOT_SIZE CONFIG_EVENTS_ISR_SLOT_SIZE
+#define ISR_FORWARD_TICKS pdMS_TO_TICKS(10)
+#define ISR_TASK_STACK_SIZE 3072
+_Static_assert((ISR_RING_SIZE & ISR_RING_MASK) == 0, "CONFIG_EVENTS_ISR_RING_SIZE must be a power of two");
+_Static_assert(ISR_SLOT_SIZE <= POST_DATA_MAX, "CONFIG_EVENTS_ISR_SLOT_SIZE larger than CONFIG_EVENTS_SLOT_SIZE");
+
+// Slot of the ISR ring. seq equal to the write position marks a free slot,
+// write position + 1 a filled one, the drain task frees it for the next round.
 typedef struct {
+    atomic_uint seq;
     esp_event_base_t event_base;
     int32_t event_id;
-    callbackHandler_t callback_handler; 
-    void* callback_handler_arg;
-} regCallbackHandler_t;
+    uint16_t size;      // the data alignment pads it anyway
+    uint8_t data[ISR_SLOT_SIZE] __attribute__((aligned(4)));
+} isrRingSlot_t;
+_Static_assert(ISR_SLOT_SIZE <= UINT16_MAX, "ISR slot size does not fit isrRingSlot_t.size");
 
-static regCallbackHandler_t* regCallbackHandlers;
-static int countCallbackHandler = 0;
+static isrRingSlot_t isrRing[ISR_RING_SIZE];
+static atomic_uint isrRingHead = 0;        // next write position, claimed by the producers
+static atomic_uint isrRingTail = 0;        // next read position, drain task only
+static atomic_uint isrPosted = 0;
+static atomic_uint isrOverflow = 0;
+static atomic_uint isrOversize = 0;
+static atomic_uint isrMaxDepth = 0;
+static uint32_t isrForwarded = 0;
+static uint32_t isrFailed = 0;
+static TaskHandle_t isrDrainTask = NULL;
+
+/// @brief Loop of the event base: routing and state changes get the high priority loop,
+/// application housekeeping the low priority one. Events of esp_wifi and esp_netif
+/// stay on the default loop.
+static eventsLoop_t *eventsLoopOf(esp_event_base_t event_base)
+{
+    if (event_base == AUDIOMATRIX_EVENT)
+        return &eventsLoops[EVENTS_LOOP_ROUTING];
+    if (event_base == ONBOARDLED_EVENT || event_base == HOME_WIFI_EVENT)
+        return &eventsLoops[EVENTS_LOOP_HOUSEKEEPING];
+    return NULL;
+}
 
-#define REG_CALLBACK_HANDLER_SIZE sizeof(regCallbackHandler_t)
-#define DATA_QUEUE_ITEM_SIZE sizeof(eventsDataQueueItem_t)
-StaticQueue_t dataQueueBuffer;
-uint8_t dataQueueStorage[CONFIG_QUEUE_SIZE * DATA_QUEUE_ITEM_SIZE];
-static QueueHandle_t dataQueueHandler = NULL;
-static eventsDataQueueItem_t* garbageDataQueueItems;
-static int countGarbageDataQueueItems = 0;
+static esp_err_t eventsLoopPost(eventsLoop_t *loop, esp_event_base_t event_base, int32_t event_id,
+    eventsEnvelope_t *envelope, size_t envelopeSize, TickType_t ticks_to_wait);
 
-static void inline __attribute__((always_inline)) dataItemInstanceDelete(eventsDataQueueItem_t* dataItem)
+/// @brief Post the pending envelope of a payload, the header alone: the loop
+/// takes the payload from the post policy on dispatch
+static esp_err_t eventsPendingKick(eventsLoop_t *loop, eventsPostPolicyEntry_t *entry)
 {
-    if (dataItem->data_allocated && dataItem->event_data.ptr) {
-        free(dataItem->event_data.ptr);
+    eventsEnvelope_t envelope = {
+        .size = 0,
+        .pending = entry - postPolicies
+    };
+    return eventsLoopPost(loop, entry->event_base, entry->event_id, &envelope, sizeof(envelope), 0);
+}
+
+/// @brief Post again the pending envelopes that did not fit the queue of the loop,
+/// runs on the loop task after it took an event off the queue
+static void eventsPendingRepost(eventsLoop_t *loop)
+{
+    taskENTER_CRITICAL(&eventsLoopLock);
+    BaseType_t unposted = unpostedTotal != 0;
+    taskEXIT_CRITICAL(&eventsLoopLock);
+    for (uint8_t num = 0; unposted == pdTRUE && num < countPostPolicies; num++) {
+        eventsPostPolicyEntry_t *entry = &postPolicies[num];
+        if (eventsLoopOf(entry->event_base) != loop)
+            continue;
+        for (;;) {
+            BaseType_t repost = pdFALSE;
+            taskENTER_CRITICAL(&eventsLoopLock);
+            if (entry->unposted) {
+                entry->unposted--;
+                unpostedTotal--;
+                repost = pdTRUE;
+            }
+            taskEXIT_CRITICAL(&eventsLoopLock);
+            if (repost == pdFALSE)
+                break;
+            esp_err_t err = eventsPendingKick(loop, entry);
+            taskENTER_CRITICAL(&eventsLoopLock);
+            if (err == ESP_OK) {
+                entry->stats.reposted++;
+            } else {
+                entry->unposted++;
+                unpostedTotal++;
+            }
+            taskEXIT_CRITICAL(&eventsLoopLock);
+            if (err != ESP_OK)
+                return; // the queue is full again, the next dispatch retries
+        }
     }
-    memset(dataItem, 0, sizeof(*dataItem));
 }
 
-static void collectGarbageDataQueueItems(){
-    for(int c = 0; c < countGarbageDataQueueItems; c++) {
-        eventsDataQueueItem_t dataItem = garbageDataQueueItems[c];
-        dataItemInstanceDelete(&dataItem);
+/// @brief First handler of every application loop, runs before the handlers of the event
+static void eventsLoopStatsHandler(void* event_handler_arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
+{
+    eventsLoop_t *loop = (eventsLoop_t *)event_handler_arg;
+    eventsEnvelope_t *envelope = (eventsEnvelope_t *)event_data;
+    if (envelope->pending != NO_INDEX) {
+        eventsPostPolicyEntry_t *entry = &postPolicies[envelope->pending];
+        taskENTER_CRITICAL(&eventsLoopLock);
+        envelope->size = 0;
+        if (entry->count) {
+            eventsPending_t *pending = &entry->pending[entry->head];
+            envelope->postTime = pending->postTime;
+            envelope->size = pending->size;
+            memcpy(entry->dispatch, pending->data, pending->size);
+            entry->head = (entry->head + 1) % POST_PENDING;
+            entry->count--;
+        }
+        taskEXIT_CRITICAL(&eventsLoopLock);
     }
-    countGarbageDataQueueItems = 0;
+    eventsPendingRepost(loop);
+    int64_t latency = esp_timer_get_time() - envelope->postTime;
+    taskENTER_CRITICAL(&eventsLoopLock);
+#if CONFIG_EVENTS_PROFILING
+    loop->dispatchPostTime = envelope->postTime;
+#endif
+    loop->stats.dispatched++;
+    loop->stats.totalLatency += latency;
+    if (latency > loop->stats.maxLatency)
+        loop->stats.maxLatency = latency;
+    taskEXIT_CRITICAL(&eventsLoopLock);
 }
 
-static void addGarbageDataQueueItem(eventsDataQueueItem_t dataItem){
-    garbageDataQueueItems[countGarbageDataQueueItems] = dataItem;
-    countGarbageDataQueueItems++;
+/// @brief Call a handler and add the call to its dispatch profile
+static void eventsHandlerProfiled(eventsHandler_t *handler, esp_event_base_t event_base, int32_t event_id,
+    void* event_data, int64_t postTime)
+{
+#if CONFIG_EVENTS_PROFILING
+    int64_t start = esp_timer_get_time();
+#endif
+    handler->event_handler(handler->event_handler_arg, event_base, event_id, event_data);
+#if CONFIG_EVENTS_PROFILING
+    int64_t time = esp_timer_get_time() - start;
+    int64_t delay = postTime ? start - postTime : 0;
+    eventsHandlerProfile_t *profile = &handler->profile;
+    taskENTER_CRITICAL(&eventsLoopLock);
+    profile->calls++;
+    profile->totalTime += time;
+    if (time > profile->maxTime)
+        profile->maxTime = time;
+    profile->totalDelay += delay;
+    if (delay > profile->maxDelay)
+        profile->maxDelay = delay;
+    taskEXIT_CRITICAL(&eventsLoopLock);
+#endif
 }
 
-esp_err_t eventsCallbackHandlerRegister(esp_event_base_t event_base, int32_t event_id,
-    callbackHandler_t callback_handler, void* callback_handler_arg)
+static void eventsHandlerCall(void* event_handler_arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
-    regCallbackHandler_t regCallbackHandler = {
-        .event_base = event_base, 
-        .event_id = event_id, 
-        .callback_handler = callback_handler, 
-        .callback_handler_arg = callback_handler_arg
-    };
-    if (countCallbackHandler < CONFIG_CALLBACK_SIZE){
-        regCallbackHandlers[countCallbackHandler] = regCallbackHandler;
-        countCallbackHandler++;
+    eventsHandler_t *handler = (eventsHandler_t *)event_handler_arg;
+    eventsEnvelope_t *envelope = (eventsEnvelope_t *)event_data;
+    void *data = NULL;
+    if (envelope->size)
+        data = envelope->pending == NO_INDEX ? envelope->data : postPolicies[envelope->pending].dispatch;
+    eventsHandlerProfiled(handler, event_base, event_id, data, envelope->postTime);
+}
+
+static eventsHandler_t *eventsHandlerAdd(esp_event_base_t event_base, int32_t event_id,
+    esp_event_handler_t event_handler, void* event_handler_arg, const char *name, bool nested)
+{
+    const char *file = strrchr(name, '/');
+    eventsHandler_t *handler = NULL;
+    taskENTER_CRITICAL(&eventsLoopLock);
+    if (countEventsHandlers < HANDLERS_MAX) {
+        handler = &eventsHandlers[countEventsHandlers++];
+        handler->event_handler = event_handler;
+        handler->event_handler_arg = event_handler_arg;
+        handler->event_base = event_base;
+        handler->event_id = event_id;
+        handler->name = file ? file + 1 : name;
+        handler->loop = eventsLoopOf(event_base);
+        handler->nested = nested;
     }
-    else {
-        ESP_LOGE(TAG, "Failed register callback handler");
-        return ESP_FAIL;
+    taskEXIT_CRITICAL(&eventsLoopLock);
+    if (handler == NULL)
+        ESP_LOGE(TAG, "Failed register handler of \"%s\" #%ld: no free handler", event_base, event_id);
+    return handler;
+}
+
+/// @brief Register a handler on the loop that carries the event base,
+/// the name identifies the handler in the dispatch profile
+esp_err_t eventsHandlerRegisterNamed(esp_event_base_t event_base, int32_t event_id,
+    esp_event_handler_t event_handler, void* event_handler_arg, const char *name)
+{
+    eventsLoop_t *loop = eventsLoopOf(event_base);
+    if (loop == NULL)
+        return esp_event_handler_register(event_base, event_id, event_handler, event_handler_arg);
+    eventsHandler_t *handler = eventsHandlerAdd(event_base, event_id, event_handler, event_handler_arg, name, false);
+    if (handler == NULL)
+        return ESP_ERR_NO_MEM;
+    return esp_event_handler_register_with(loop->handle, event_base, event_id, eventsHandlerCall, handler);
+}
+
+/// @brief Register a handler that a component dispatcher calls itself with
+/// eventsNestedHandlerCall(), so it gets a dispatch profile of its own.
+/// The time of the dispatcher includes its nested handlers.
+esp_err_t eventsNestedHandlerRegisterNamed(esp_event_base_t event_base, int32_t event_id,
+    esp_event_handler_t event_handler, void* event_handler_arg, const char *name, eventsNestedHandle_t *handle)
+{
+    *handle = eventsHandlerAdd(event_base, event_id, event_handler, event_handler_arg, name, true);
+    return *handle ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+/// @brief Call a nested handler from the dispatcher running on the loop task,
+/// the delay is measured from the post of the event being dispatched
+void eventsNestedHandlerCall(eventsNestedHandle_t handle, esp_event_base_t event_base, int32_t event_id, void* event_data)
+{
+    int64_t postTime = 0;
+#if CONFIG_EVENTS_PROFILING
+    if (handle->loop != NULL)
+        postTime = handle->loop->dispatchPostTime;
+#endif
+    eventsHandlerProfiled(handle, event_base, event_id, event_data, postTime);
+}
+
+static eventsPostPolicyEntry_t *postPolicyFind(esp_event_base_t event_base, int32_t event_id)
+{
+    for (uint8_t num = 0; num < countPostPolicies; num++) {
+        eventsPostPolicyEntry_t *entry = &postPolicies[num];
+        if (entry->event_base == event_base && entry->event_id == event_id)
+            return entry;
     }
-    return ESP_OK;
+    return NULL;
 }
 
-esp_err_t eventsCallbackExec(esp_event_base_t event_base, int32_t event_id,
-    void* event_data)
+/// @brief Set how eventsPost() treats a full loop for the event: EVENTS_POST_BLOCK waits
+/// up to timeout, EVENTS_POST_DROP_OLDEST and EVENTS_POST_COALESCE never wait and keep up
+/// to CONFIG_EVENTS_POST_PENDING payloads. Drop-oldest then drops the oldest one. Coalesce
+/// replaces the payload of a pending event whose first keySize bytes are equal, keySize 0
+/// keeps only the latest payload; a payload of another key never replaces it.
+esp_err_t eventsPostPolicySet(esp_event_base_t event_base, int32_t event_id,
+    eventsPostPolicy_t policy, TickType_t timeout, size_t keySize)
 {
-    for(int c = 0; c < countCallbackHandler; c++){
-        regCallbackHandler_t regCallbackHandler = regCallbackHandlers[c];
-        if(regCallbackHandler.event_base == event_base && regCallbackHandler.event_id == event_id){
-            regCallbackHandler.callback_handler(regCallbackHandler.callback_handler_arg, event_base, event_id, event_data);
-        }
+    if (event_id == ESP_EVENT_ANY_ID || keySize > POST_DATA_MAX)
+        return ESP_ERR_INVALID_ARG;
+    if (policy != EVENTS_POST_BLOCK && eventsLoopOf(event_base) == NULL)
+        return ESP_ERR_NOT_SUPPORTED;
+    eventsPostPolicyEntry_t *entry = NULL;
+    taskENTER_CRITICAL(&eventsLoopLock);
+    if (postPolicyFind(event_base, event_id) == NULL && countPostPolicies < POST_POLICIES) {
+        entry = &postPolicies[countPostPolicies++];
+        entry->event_base = event_base;
+        entry->event_id = event_id;
+        entry->policy = policy;
+        entry->timeout = timeout;
+        entry->keySize = keySize;
+    }
+    taskEXIT_CRITICAL(&eventsLoopLock);
+    if (entry == NULL) {
+        ESP_LOGE(TAG, "Failed set post policy of \"%s\" #%ld", event_base, event_id);
+        return ESP_ERR_NO_MEM;
     }
     return ESP_OK;
 }
 
-BaseType_t eventsDataQueuePost(esp_event_base_t event_base, int32_t event_id,
-    void* event_data, size_t event_data_size, TickType_t ticks_to_wait)
+static void postPolicyCount(eventsPostPolicyEntry_t *entry, esp_err_t err)
 {
-    collectGarbageDataQueueItems();
-    if (dataQueueHandler == NULL){
-        ESP_LOGE(TAG, "No QueueHandler");
-        return pdFALSE;
+    taskENTER_CRITICAL(&eventsLoopLock);
+    if (err == ESP_OK)
+        entry->stats.posted++;
+    else
+        entry->stats.dropped++;
+    taskEXIT_CRITICAL(&eventsLoopLock);
+}
+
+static esp_err_t eventsLoopPost(eventsLoop_t *loop, esp_event_base_t event_base, int32_t event_id,
+    eventsEnvelope_t *envelope, size_t envelopeSize, TickType_t ticks_to_wait)
+{
+    taskENTER_CRITICAL(&eventsLoopLock);
+    loop->stats.posted++;
+    uint32_t depth = loop->stats.posted - loop->stats.dispatched;
+    if (depth > loop->stats.maxDepth)
+        loop->stats.maxDepth = depth;
+    taskEXIT_CRITICAL(&eventsLoopLock);
+    envelope->postTime = esp_timer_get_time();
+    esp_err_t err = esp_event_post_to(loop->handle, event_base, event_id, envelope, envelopeSize, ticks_to_wait);
+    if (err != ESP_OK) {
+        taskENTER_CRITICAL(&eventsLoopLock);
+        loop->stats.posted--;
+        loop->stats.failed++;
+        taskEXIT_CRITICAL(&eventsLoopLock);
     }
-    eventsDataQueueItem_t dataItem;
-    memset((void*)(&dataItem), 0, sizeof(dataItem));
-    if (event_data != NULL && event_data_size != 0) {
-        // Make persistent copy of event data on heap.
-        void* event_data_copy = calloc(1, event_data_size);
+    return err;
+}
 
-        if (event_data_copy == NULL) {
-            return ESP_ERR_NO_MEM;
+/// @brief Post a payload of a pending policy in an envelope of its own
+static esp_err_t eventsDirectPost(eventsLoop_t *loop, eventsPostPolicyEntry_t *entry,
+    const void* event_data, size_t event_data_size)
+{
+    uint8_t buffer[sizeof(eventsEnvelope_t) + POST_DATA_MAX] __attribute__((aligned(8)));
+    eventsEnvelope_t *envelope = (eventsEnvelope_t *)buffer;
+    envelope->size = event_data_size;
+    envelope->pending = NO_INDEX;
+    if (event_data_size)
+        memcpy(envelope->data, event_data, event_data_size);
+    esp_err_t err = eventsLoopPost(loop, entry->event_base, entry->event_id, envelope,
+        sizeof(eventsEnvelope_t) + event_data_size, PENDING_TICKS);
+    postPolicyCount(entry, err);
+    return err;
+}
+
+/// @brief Queue the payload of a drop-oldest or coalesce event, a pending envelope
+/// is posted only for a payload that did not replace another one. A keyed coalesce
+/// only ever replaces a payload of the same key: with every pending slot taken by
+/// other keys the payload is posted in an envelope of its own.
+static esp_err_t eventsPendingPost(eventsLoop_t *loop, eventsPostPolicyEntry_t *entry,
+    const void* event_data, size_t event_data_size)
+{
+    if (xSemaphoreTake(pendingMutex, PENDING_TICKS) != pdTRUE) {
+        postPolicyCount(entry, ESP_ERR_TIMEOUT);
+        return ESP_ERR_TIMEOUT;
+    }
+    BaseType_t kick = pdTRUE;
+    BaseType_t direct = pdFALSE;
+    eventsPending_t *pending = NULL;
+    taskENTER_CRITICAL(&eventsLoopLock);
+    if (entry->policy == EVENTS_POST_COALESCE) {
+        for (uint8_t i = 0; i < entry->count; i++) {
+            eventsPending_t *same = &entry->pending[(entry->head + i) % POST_PENDING];
+            if (same->size >= entry->keySize && event_data_size >= entry->keySize
+                && memcmp(same->data, event_data, entry->keySize) == 0) {
+                pending = same;
+                entry->stats.coalesced++;
+                kick = pdFALSE;
+                break;
+            }
+        }
+        direct = pending == NULL && entry->count == POST_PENDING;
+    }
+    if (pending == NULL && direct == pdFALSE) {
+        if (entry->count == POST_PENDING) {
+            // The envelope of the dropped payload delivers the new one
+            entry->head = (entry->head + 1) % POST_PENDING;
+            entry->count--;
+            entry->stats.dropped++;
+            kick = pdFALSE;
         }
+        pending = &entry->pending[(entry->head + entry->count) % POST_PENDING];
+        pending->postTime = esp_timer_get_time();
+        entry->count++;
+        if (entry->count > entry->stats.maxPending)
+            entry->stats.maxPending = entry->count;
+    }
+    if (pending != NULL) {
+        pending->size = event_data_size;
+        if (event_data_size)
+            memcpy(pending->data, event_data, event_data_size);
+        entry->stats.posted++;
+    }
+    taskEXIT_CRITICAL(&eventsLoopLock);
 
-        memcpy(event_data_copy, event_data, event_data_size);
-        dataItem.event_data.ptr = event_data_copy;
-        dataItem.data_allocated = true;
-        dataItem.data_set = true;
+    if (direct == pdTRUE) {
+        // No pending payload of the key to order against, other posters go on meanwhile
+        xSemaphoreGive(pendingMutex);
+        return eventsDirectPost(loop, entry, event_data, event_data_size);
     }
-    dataItem.event_base = event_base;
-    dataItem.event_id = event_id;
-    BaseType_t result = pdFALSE;
-    result = xQueueSendToBack(dataQueueHandler, &dataItem, ticks_to_wait);
-    if (result != pdTRUE) {
-        dataItemInstanceDelete(&dataItem);
-        ESP_LOGE(TAG, "Failed to adding data to events queue!");
+    if (kick == pdTRUE && eventsPendingKick(loop, entry) != ESP_OK) {
+        // A full loop queue has an event to dispatch, its first handler posts the envelope
+        taskENTER_CRITICAL(&eventsLoopLock);
+        entry->unposted++;
+        unpostedTotal++;
+        taskEXIT_CRITICAL(&eventsLoopLock);
     }
-    return result;
-}    
+    xSemaphoreGive(pendingMutex);
+    return ESP_OK;
+}
 
-BaseType_t eventsDataQueuePostFromISR(esp_event_base_t event_base, int32_t event_id,
-    void* event_data, size_t event_data_size, BaseType_t* task_unblocked)
+/// @brief Post an event to the loop that carries the event base. The post policy of
+/// the event, if set, replaces ticks_to_wait.
+esp_err_t eventsPost(esp_event_base_t event_base, int32_t event_id,
+    const void* event_data, size_t event_data_size, TickType_t ticks_to_wait)
 {
-    collectGarbageDataQueueItems();
-    if (dataQueueHandler == NULL){
-        ESP_LOGE(TAG, "No QueueHandler");
-        return pdFALSE;
+    eventsLoop_t *loop = eventsLoopOf(event_base);
+    eventsPostPolicyEntry_t *entry = postPolicyFind(event_base, event_id);
+    if (entry != NULL)
+        ticks_to_wait = entry->timeout;
+    if (loop == NULL) {
+        esp_err_t err = esp_event_post(event_base, event_id, event_data, event_data_size, ticks_to_wait);
+        if (entry != NULL)
+            postPolicyCount(entry, err);
+        return err;
     }
-    eventsDataQueueItem_t dataItem;
-    memset((void*)(&dataItem), 0, sizeof(dataItem));
-    if (event_data_size > sizeof(dataItem.event_data.val)) {
-        ESP_LOGE(TAG, "Invalid event_data_size for adding data to events queue!");
+    if (event_data == NULL)
+        event_data_size = 0;
+    if (event_data_size > POST_DATA_MAX)
         return ESP_ERR_INVALID_ARG;
+    if (entry != NULL && entry->policy != EVENTS_POST_BLOCK)
+        return eventsPendingPost(loop, entry, event_data, event_data_size);
+
+    uint8_t buffer[sizeof(eventsEnvelope_t) + POST_DATA_MAX] __attribute__((aligned(8)));
+    eventsEnvelope_t *envelope = (eventsEnvelope_t *)buffer;
+    envelope->size = event_data_size;
+    envelope->pending = NO_INDEX;
+    if (event_data_size)
+        memcpy(envelope->data, event_data, event_data_size);
+    esp_err_t err = eventsLoopPost(loop, event_base, event_id, envelope, sizeof(eventsEnvelope_t) + event_data_size, ticks_to_wait);
+    if (entry != NULL)
+        postPolicyCount(entry, err);
+    return err;
+}
+
+/// @brief Counters of the post policy of the event, pdFALSE if no policy is set
+BaseType_t eventsPostPolicyStats(esp_event_base_t event_base, int32_t event_id, eventsPostPolicyStats_t *stats)
+{
+    eventsPostPolicyEntry_t *entry = postPolicyFind(event_base, event_id);
+    if (entry == NULL)
+        return pdFALSE;
+    taskENTER_CRITICAL(&eventsLoopLock);
+    *stats = entry->stats;
+    stats->pending = entry->count;
+    taskEXIT_CRITICAL(&eventsLoopLock);
+    return pdTRUE;
+}
+
+/// @brief Counters of an application loop, depth is the number of events waiting now
+BaseType_t eventsLoopStats(eventsLoopId_t loopId, eventsLoopStats_t *stats)
+{
+    if (loopId >= EVENTS_LOOPS)
+        return pdFALSE;
+    taskENTER_CRITICAL(&eventsLoopLock);
+    *stats = eventsLoops[loopId].stats;
+    taskEXIT_CRITICAL(&eventsLoopLock);
+    stats->depth = stats->posted - stats->dispatched;
+    return pdTRUE;
+}
+
+/// @brief Dispatch profile of the registered application loop handlers in registration
+/// order, returns the number of profiles copied, 0 without CONFIG_EVENTS_PROFILING
+size_t eventsHandlerProfiles(eventsHandlerProfile_t *profiles, size_t size)
+{
+    size_t count = 0;
+#if CONFIG_EVENTS_PROFILING
+    taskENTER_CRITICAL(&eventsLoopLock);
+    for (; count < countEventsHandlers && count < size; count++) {
+        profiles[count] = eventsHandlers[count].profile;
+    }
+    taskEXIT_CRITICAL(&eventsLoopLock);
+#endif
+    return count;
+}
+
+const char * getJsonEventsProfile()
+{
+    static const char *loopNames[EVENTS_LOOPS] = { "routing", "housekeeping" };
+    cJSON *root = cJSON_CreateObject();
+    cJSON *json_loops = cJSON_AddArrayToObject(root, "loops");
+    for (eventsLoopId_t loopId = 0; loopId < EVENTS_LOOPS; loopId++) {
+        eventsLoopStats_t stats;
+        eventsLoopStats(loopId, &stats);
+        cJSON *json_loop;
+        cJSON_AddItemToArray(json_loops, json_loop = cJSON_CreateObject());
+        cJSON_AddStringToObject(json_loop, "name", loopNames[loopId]);
+        cJSON_AddNumberToObject(json_loop, "posted", stats.posted);
+        cJSON_AddNumberToObject(json_loop, "dispatched", stats.dispatched);
+        cJSON_AddNumberToObject(json_loop, "failed", stats.failed);
+        cJSON_AddNumberToObject(json_loop, "depth", stats.depth);
+        cJSON_AddNumberToObject(json_loop, "maxDepth", stats.maxDepth);
+        cJSON_AddNumberToObject(json_loop, "avgLatency", stats.dispatched ? stats.totalLatency / stats.dispatched : 0);
+        cJSON_AddNumberToObject(json_loop, "maxLatency", stats.maxLatency);
+    }
+    static const char *policyNames[] = { "block", "dropOldest", "coalesce" };
+    cJSON *json_policies = cJSON_AddArrayToObject(root, "policies");
+    for (uint8_t num = 0; num < countPostPolicies; num++) {
+        eventsPostPolicyEntry_t *entry = &postPolicies[num];
+        eventsPostPolicyStats_t stats;
+        eventsPostPolicyStats(entry->event_base, entry->event_id, &stats);
+        cJSON *json_policy;
+        cJSON_AddItemToArray(json_policies, json_policy = cJSON_CreateObject());
+        cJSON_AddStringToObject(json_policy, "base", entry->event_base);
+        cJSON_AddNumberToObject(json_policy, "id", entry->event_id);
+        cJSON_AddStringToObject(json_policy, "policy", policyNames[entry->policy]);
+        cJSON_AddNumberToObject(json_policy, "posted", stats.posted);
+        cJSON_AddNumberToObject(json_policy, "coalesced", stats.coalesced);
+        cJSON_AddNumberToObject(json_policy, "dropped", stats.dropped);
+        cJSON_AddNumberToObject(json_policy, "reposted", stats.reposted);
+        cJSON_AddNumberToObject(json_policy, "pending", stats.pending);
+        cJSON_AddNumberToObject(json_policy, "maxPending", stats.maxPending);
     }
-    if (event_data != NULL && event_data_size != 0) {
-        memcpy((void*)(&(dataItem.event_data.val)), event_data, event_data_size);
-        dataItem.data_allocated = false;
-        dataItem.data_set = true;
-    }
-    dataItem.event_base = event_base;
-    dataItem.event_id = event_id;
-    BaseType_t result = pdFALSE;
-    result = xQueueSendToBackFromISR(dataQueueHandler, &dataItem, task_unblocked);
-    if (result != pdTRUE) {
-        dataItemInstanceDelete(&dataItem);
-        ESP_LOGE(TAG, "Failed to adding data to events queue!");
-    }
-    return result;
-}  
-
-BaseType_t eventsDataQueueGet(esp_event_base_t event_base, int32_t event_id,
-    event_data_t* event_data, TickType_t ticks_to_wait)
-{
-    eventsDataQueueItem_t dataItem;
-    BaseType_t result = pdFALSE;
-    void* data_ptr = NULL;
-    if (dataQueueHandler == NULL){
+    eventsIsrRingStats_t isrStats;
+    eventsIsrRingStats(&isrStats);
+    cJSON *json_isr = cJSON_AddObjectToObject(root, "isrRing");
+    cJSON_AddNumberToObject(json_isr, "posted", isrStats.posted);
+    cJSON_AddNumberToObject(json_isr, "forwarded", isrStats.forwarded);
+    cJSON_AddNumberToObject(json_isr, "failed", isrStats.failed);
+    cJSON_AddNumberToObject(json_isr, "overflow", isrStats.overflow);
+    cJSON_AddNumberToObject(json_isr, "oversize", isrStats.oversize);
+    cJSON_AddNumberToObject(json_isr, "depth", isrStats.depth);
+    cJSON_AddNumberToObject(json_isr, "maxDepth", isrStats.maxDepth);
+#if CONFIG_EVENTS_PROFILING
+    eventsHandlerProfile_t *profiles = malloc(HANDLERS_MAX * sizeof(eventsHandlerProfile_t));
+    if (profiles == NULL) {
+        cJSON_Delete(root);
+        return NULL;
+    }
+    size_t count = eventsHandlerProfiles(profiles, HANDLERS_MAX);
+    cJSON *json_handlers = cJSON_AddArrayToObject(root, "handlers");
+    for (size_t i = 0; i < count; i++) {
+        eventsHandler_t *handler = &eventsHandlers[i];
+        eventsHandlerProfile_t *profile = &profiles[i];
+        cJSON *json_handler;
+        cJSON_AddItemToArray(json_handlers, json_handler = cJSON_CreateObject());
+        cJSON_AddStringToObject(json_handler, "name", handler->name);
+        cJSON_AddStringToObject(json_handler, "base", handler->event_base);
+        cJSON_AddNumberToObject(json_handler, "id", handler->event_id);
+        if (handler->nested)
+            cJSON_AddBoolToObject(json_handler, "nested", true);
+        cJSON_AddNumberToObject(json_handler, "calls", profile->calls);
+        cJSON_AddNumberToObject(json_handler, "totalTime", profile->totalTime);
+        cJSON_AddNumberToObject(json_handler, "avgTime", profile->calls ? profile->totalTime / profile->calls : 0);
+        cJSON_AddNumberToObject(json_handler, "maxTime", profile->maxTime);
+        cJSON_AddNumberToObject(json_handler, "avgDelay", profile->calls ? profile->totalDelay / profile->calls : 0);
+        cJSON_AddNumberToObject(json_handler, "maxDelay", profile->maxDelay);
+    }
+    free(profiles);
+#endif
+
+    char *json = cJSON_Print(root);
+    cJSON_Delete(root);
+    return json;
+}
+
+/// @brief Post an event from an ISR: the payload is copied into a slot of a lock-free
+/// ring and the drain task forwards it with eventsPost(). Takes no lock, touches no
+/// heap and does not log, a full ring or a payload above CONFIG_EVENTS_ISR_SLOT_SIZE
+/// is only counted. Producers may run on both cores.
+BaseType_t eventsPostFromISR(esp_event_base_t event_base, int32_t event_id,
+    const void* event_data, size_t event_data_size, BaseType_t* task_unblocked)
+{
+    if (isrDrainTask == NULL)
+        return pdFALSE;
+    if (event_data == NULL)
+        event_data_size = 0;
+    if (event_data_size > ISR_SLOT_SIZE) {
+        atomic_fetch_add_explicit(&isrOversize, 1, memory_order_relaxed);
         return pdFALSE;
     }
-    if (xQueuePeek(dataQueueHandler, &dataItem, ticks_to_wait) == pdTRUE)
-    {
-        if(dataItem.event_base == event_base && dataItem.event_id == event_id){
-            xQueueReceive(dataQueueHandler, &dataItem, ticks_to_wait);
-            if (dataItem.data_set){
-                if (dataItem.data_allocated){
-                    data_ptr = dataItem.event_data.ptr;
-                }
-                else {
-                    data_ptr = &(dataItem.event_data.val);
-                }
-                addGarbageDataQueueItem(dataItem);
-                result = pdTRUE;
-            }
+    isrRingSlot_t *slot;
+    unsigned int pos = atomic_load_explicit(&isrRingHead, memory_order_relaxed);
+    for (;;) {
+        slot = &isrRing[pos & ISR_RING_MASK];
+        int32_t diff = (int32_t)(atomic_load_explicit(&slot->seq, memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&isrRingHead, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&isrOverflow, 1, memory_order_relaxed);
+            return pdFALSE;
+        } else {
+            pos = atomic_load_explicit(&isrRingHead, memory_order_relaxed);
         }
     }
-    *event_data = (event_data_t)data_ptr;
-    return result;
-}
-
-BaseType_t eventsDataQueueGetFromISR(esp_event_base_t event_base, int32_t event_id,
-    event_data_t* event_data, BaseType_t *const pxHigherPriorityTaskWoken)
-{
-    eventsDataQueueItem_t dataItem;
-    BaseType_t result = pdFALSE;
-    void* data_ptr = NULL;
-    if (xQueuePeekFromISR(dataQueueHandler, &dataItem) == pdTRUE)
-    {
-        if(dataItem.event_base == event_base && dataItem.event_id == event_id){
-            xQueueReceiveFromISR(dataQueueHandler, &dataItem, pxHigherPriorityTaskWoken);
-            if (dataItem.data_set){
-                if (dataItem.data_allocated){
-                    data_ptr = dataItem.event_data.ptr;
-                }
-                else {
-                    data_ptr = &(dataItem.event_data.val);
-                }
-                addGarbageDataQueueItem(dataItem);
-                result = pdTRUE;
-            }
+    slot->event_base = event_base;
+    slot->event_id = event_id;
+    slot->size = event_data_size;
+    if (event_data_size)
+        memcpy(slot->data, event_data, event_data_size);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    atomic_fetch_add_explicit(&isrPosted, 1, memory_order_relaxed);
+    unsigned int depth = pos + 1 - atomic_load_explicit(&isrRingTail, memory_order_relaxed);
+    unsigned int maxDepth = atomic_load_explicit(&isrMaxDepth, memory_order_relaxed);
+    while (depth > maxDepth && !atomic_compare_exchange_weak_explicit(&isrMaxDepth, &maxDepth, depth, memory_order_relaxed, memory_order_relaxed)) {
+    }
+    vTaskNotifyGiveFromISR(isrDrainTask, task_unblocked);
+    return pdTRUE;
+}
+
+/// @brief Counters of the ISR ring, depth is the number of events waiting now
+void eventsIsrRingStats(eventsIsrRingStats_t *stats)
+{
+    unsigned int head = atomic_load_explicit(&isrRingHead, memory_order_relaxed);
+    stats->posted = atomic_load_explicit(&isrPosted, memory_order_relaxed);
+    stats->overflow = atomic_load_explicit(&isrOverflow, memory_order_relaxed);
+    stats->oversize = atomic_load_explicit(&isrOversize, memory_order_relaxed);
+    taskENTER_CRITICAL(&eventsLoopLock);
+    stats->forwarded = isrForwarded;
+    stats->failed = isrFailed;
+    taskEXIT_CRITICAL(&eventsLoopLock);
+    stats->depth = head - atomic_load_explicit(&isrRingTail, memory_order_relaxed);
+    stats->maxDepth = atomic_load_explicit(&isrMaxDepth, memory_order_relaxed);
+}
+
+/// @brief Take the oldest filled slot of the ISR ring, pdFALSE if the ring is empty
+/// or the oldest slot is still being written
+static BaseType_t isrRingPop(esp_event_base_t *event_base, int32_t *event_id, uint8_t *data, size_t *size)
+{
+    unsigned int pos = atomic_load_explicit(&isrRingTail, memory_order_relaxed);
+    isrRingSlot_t *slot = &isrRing[pos & ISR_RING_MASK];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1)
+        return pdFALSE;
+    *event_base = slot->event_base;
+    *event_id = slot->event_id;
+    *size = slot->size;
+    memcpy(data, slot->data, slot->size);
+    atomic_store_explicit(&slot->seq, pos + ISR_RING_SIZE, memory_order_release);
+    atomic_store_explicit(&isrRingTail, pos + 1, memory_order_relaxed);
+    return pdTRUE;
+}
+
+static void isrDrain(void *pvParameters)
+{
+    uint8_t data[ISR_SLOT_SIZE] __attribute__((aligned(4)));
+    esp_event_base_t event_base;
+    int32_t event_id;
+    size_t size;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (isrRingPop(&event_base, &event_id, data, &size) == pdTRUE) {
+            esp_err_t err = eventsPost(event_base, event_id, size ? data : NULL, size, ISR_FORWARD_TICKS);
+            taskENTER_CRITICAL(&eventsLoopLock);
+            if (err == ESP_OK)
+                isrForwarded++;
+            else
+                isrFailed++;
+            taskEXIT_CRITICAL(&eventsLoopLock);
         }
     }
-    *event_data = (event_data_t)data_ptr;
-    return result;
+}
+
+static void isrRingInit(void)
+{
+    for (unsigned int pos = 0; pos < ISR_RING_SIZE; pos++) {
+        atomic_init(&isrRing[pos].seq, pos);
+    }
+    static StaticTask_t xTaskBuffer;
+    static StackType_t xStack[ISR_TASK_STACK_SIZE];
+    isrDrainTask = xTaskCreateStatic(isrDrain, "isrEventsDrain", ISR_TASK_STACK_SIZE, NULL, CONFIG_EVENTS_ISR_TASK_PRIORITY, xStack, &xTaskBuffer);
+    if (isrDrainTask == NULL) {
+        ESP_LOGE(TAG, "Task isrEventsDrain not created");
+    }
+}
+
+static void eventsLoopCreate(eventsLoopId_t loopId, const char *name, int32_t queueSize, UBaseType_t priority)
+{
+    esp_event_loop_args_t loopArgs = {
+        .queue_size = queueSize,
+        .task_name = name,
+        .task_priority = priority,
+        .task_stack_size = CONFIG_EVENTS_LOOP_STACK_SIZE,
+        .task_core_id = tskNO_AFFINITY
+    };
+    eventsLoop_t *loop = &eventsLoops[loopId];
+    ESP_ERROR_CHECK(esp_event_loop_create(&loopArgs, &loop->handle));
+    ESP_ERROR_CHECK(esp_event_handler_register_with(loop->handle, ESP_EVENT_ANY_BASE, ESP_EVENT_ANY_ID, eventsLoopStatsHandler, loop));
 }
 
 void eventsInit(void)
 {
     ESP_ERROR_CHECK(esp_event_loop_create_default());
-    regCallbackHandlers = (regCallbackHandler_t*)malloc(CONFIG_CALLBACK_SIZE * REG_CALLBACK_HANDLER_SIZE);
-    garbageDataQueueItems = (eventsDataQueueItem_t*)malloc(CONFIG_QUEUE_SIZE * DATA_QUEUE_ITEM_SIZE);
-    dataQueueHandler = xQueueCreateStatic(CONFIG_QUEUE_SIZE, DATA_QUEUE_ITEM_SIZE, &dataQueueStorage[0], &dataQueueBuffer);
+    eventsLoopCreate(EVENTS_LOOP_ROUTING, "routingEvents", CONFIG_EVENTS_ROUTING_QUEUE_SIZE, CONFIG_EVENTS_ROUTING_PRIORITY);
+    eventsLoopCreate(EVENTS_LOOP_HOUSEKEEPING, "housekeepingEvents", CONFIG_EVENTS_HOUSEKEEPING_QUEUE_SIZE, CONFIG_EVENTS_HOUSEKEEPING_PRIORITY);
+    static StaticSemaphore_t xMutexBuffer;
+    pendingMutex = xSemaphoreCreateMutexStatic(&xMutexBuffer);
+    // A flood of route commands must not stall the routing path: port changes coalesce
+    // per output, the LED shows the latest color only
+    TickType_t timeout = pdMS_TO_TICKS(CONFIG_EVENTS_POST_TIMEOUT);
+    ESP_ERROR_CHECK(eventsPostPolicySet(AUDIOMATRIX_EVENT, AUDIOMATRIX_EVENT_PORT_CHANGED, EVENTS_POST_COALESCE, 0, sizeof(uint8_t)));
+    ESP_ERROR_CHECK(eventsPostPolicySet(AUDIOMATRIX_EVENT, AUDIOMATRIX_EVENT_CONFIG_CHANGED, EVENTS_POST_BLOCK, timeout, 0));
+    ESP_ERROR_CHECK(eventsPostPolicySet(AUDIOMATRIX_EVENT, AUDIOMATRIX_EVENT_PORTS_CHANGED, EVENTS_POST_BLOCK, timeout, 0));
+    ESP_ERROR_CHECK(eventsPostPolicySet(ONBOARDLED_EVENT, ONBOARDLED_EVENT_SETCOLOR, EVENTS_POST_COALESCE, 0, 0));
+    ESP_ERROR_CHECK(eventsPostPolicySet(HOME_WIFI_EVENT, HOME_WIFI_EVENT_START, EVENTS_POST_BLOCK, timeout, 0));
+    ESP_ERROR_CHECK(eventsPostPolicySet(HOME_WIFI_EVENT, HOME_WIFI_EVENT_STOP, EVENTS_POST_BLOCK, timeout, 0));
+    isrRingInit();
     ESP_LOGI(TAG, "Events init finish");
 }
\ No newline at end of file
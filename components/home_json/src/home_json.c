@@ -13,13 +13,25 @@ const char * JSON_Message(const char *mes )
     return jmes;
 }
 
+/// @brief Copy a UTF-8 string, a cut never splits a multibyte character
+static void utf8Copy(char *out, const char *in, size_t outSize)
+{
+    if (outSize == 0 || strlcpy(out, in, outSize) < outSize)
+        return;
+    // The first byte left out continues a character: drop its copied part too
+    size_t end = outSize - 1;
+    while (end > 0 && ((unsigned char)in[end] & 0xC0) == 0x80)
+        end--;
+    out[end] = '\0';
+}
+
 void jsonStrValue(cJSON *json, char *out, size_t outSize, char *param, char *def)
 {
     if (cJSON_HasObjectItem(json, param)) {
-        strlcpy(out, cJSON_GetObjectItem(json, param)->valuestring, outSize);
+        utf8Copy(out, cJSON_GetObjectItem(json, param)->valuestring, outSize);
     }
     else {
-        strlcpy(out, def, outSize);
+        utf8Copy(out, def, outSize);
     }
 }
 
@@ -10,6 +10,7 @@ extern "C" {
 
 mqttConfig_t * getMqttConfig();
 const char * getJsonMqttConfig();
+void mqttStatePublishStats(mqttStatePublishStats_t *stats);
 BaseType_t saveMqttConfig(mqttConfig_t *pMqttConfig);
 BaseType_t setMqttDefaultPreferences();
 void mqttClientInit(void);
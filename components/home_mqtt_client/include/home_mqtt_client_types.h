@@ -23,6 +23,15 @@ typedef enum {
     HOME_MQTT_CONNECTING
 } mqttState_t;
 
+typedef struct {
+    uint32_t changes;       // state changes reported by the audiomatrix
+    uint32_t published;     // state publishes
+    uint32_t coalesced;     // changes folded into another publish
+    uint32_t trailing;      // publishes delayed to the end of the window
+    uint64_t delayTotal;    // us added by trailing publishes
+    uint32_t delayMax;      // us
+} mqttStatePublishStats_t;
+
 #ifdef __cplusplus
 }
 #endif
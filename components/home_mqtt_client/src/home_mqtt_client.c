@@ -1,12 +1,16 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include <stdatomic.h>
 #include "mqtt_client.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
 #include "nvs_preferences.h"
 #include "home_json.h"
 #include "home_mqtt_client.h"
 #include "events_types.h"
 #include "audiomatrix.h"
+#include "matrix_relay.h"
 
 static const char *TAG = "home_mqtt_client";
 
@@ -15,6 +19,8 @@ static const char *TAG = "home_mqtt_client";
 #define PUBLISH_STATE_BIT       BIT0
 #define PUBLISH_CONFIG_BIT      BIT1
 #define SUBSCRIBE_STATE_BIT     BIT2
+#define WEAR_PUBLISH_PERIOD_US ((int64_t)CONFIG_MQTT_WEAR_PUBLISH_PERIOD * 60 * 1000 * 1000)
+#define STATE_COALESCE_WINDOW_US ((int64_t)CONFIG_MQTT_STATE_COALESCE_WINDOW * 1000)
 #define MUTEX_TAKE_TICK_PERIOD 1000 / portTICK_PERIOD_MS
 #define STACK_SIZE 5120
 #define MQTT_MAXIMUM_RETRY 5
@@ -28,18 +34,238 @@ static int s_retry_num = 0;
 mqttState_t mqttState;
 static bool mqttClientState = false;;
 static char subcribedStateTopic[64] = "";
+static char subcribedStatusTopic[80] = "";
+// Hash of the retained discovery topic and payload per output and class and of the
+// device-based discovery, kept in NVS
+#define DISCOVERY_CLASSES 2
+typedef struct {
+    uint32_t outputs[OUT_PORTS][DISCOVERY_CLASSES];
+    uint32_t device;
+} discoveryCache_t;
+static discoveryCache_t discoveryCache;
+// A discovery goes out at QoS 1, its hash enters the cache when the broker acknowledges it
+#define DISCOVERY_SLOTS (OUT_PORTS * DISCOVERY_CLASSES + 1)
+#define DISCOVERY_DEVICE_SLOT (OUT_PORTS * DISCOVERY_CLASSES)
+typedef struct {
+    int msgId;          // publish waiting for PUBACK, 0 none
+    uint32_t hash;
+} discoveryPending_t;
+static discoveryPending_t discoveryPending[DISCOVERY_SLOTS];
+static uint8_t discoveryPendingCount = 0;
+static bool discoveryChanged = false;      // acknowledged hashes not saved yet
+static int discoveryEarlyAck = 0;          // acknowledge that came before its publish returned
+static portMUX_TYPE discoveryLock = portMUX_INITIALIZER_UNLOCKED;
+static atomic_bool discoveryForce = false;  // Home Assistant restarted or the broker changed, publish everything
+#if CONFIG_AM_MQTT_OUTPUT_STATE_TOPICS
+_Static_assert(OUT_PORTS <= 32, "dirty output mask holds 32 outputs");
+#define ALL_OUTPUTS ((uint32_t)(((uint64_t)1 << OUT_PORTS) - 1))
+static atomic_uint dirtyOutputs = 0;        // outputs changed since the last publish
+static int16_t publishedInputs[OUT_PORTS];  // input retained on the output topic, -1 unknown
+#endif
 
-static void subscribeState()
+// State publishes: the first change after an idle window goes out at once, changes
+// inside the window wait for one trailing publish
+static int64_t statePublishedAt = 0;       // us, last state publish
+static int64_t statePendingSince = 0;      // us, first change waiting for the trailing publish, 0 none
+static atomic_uint stateChanges = 0;
+static atomic_uint statePublished = 0;
+static atomic_uint stateTrailing = 0;
+static atomic_ullong stateDelayTotal = 0;
+static atomic_uint stateDelayMax = 0;
+// Wear is published on its own deadline, the event wait restarts on every state or config bit
+static int64_t wearPublishAt = 0;          // us
+
+/// @brief Subscribe to the topic unless it is subscribed already. The broker resends a
+/// retained message on every subscribe, so a topic is subscribed again only on connect
+/// or when it changes.
+static void subscribeTopic(char *subscribed, size_t subscribedSize, const char *topic, bool connected)
 {
-    if (strlen(subcribedStateTopic) != 0)
-        esp_mqtt_client_unsubscribe(client, subcribedStateTopic);
-    getHaMQTTStateTopic(subcribedStateTopic, sizeof(subcribedStateTopic));
-    strlcat(subcribedStateTopic, "/set/#", sizeof(subcribedStateTopic));
-    ESP_LOGI(TAG, "Subscribe to a topic \"%s\"", subcribedStateTopic);
-    esp_mqtt_client_subscribe(client, subcribedStateTopic, 0);
+    if (!connected && strcmp(subscribed, topic) == 0)
+        return;
+    if (strlen(subscribed) != 0 && strcmp(subscribed, topic) != 0)
+        esp_mqtt_client_unsubscribe(client, subscribed);
+    strlcpy(subscribed, topic, subscribedSize);
+    ESP_LOGI(TAG, "Subscribe to a topic \"%s\"", subscribed);
+    esp_mqtt_client_subscribe(client, subscribed, 0);
 }
 
-static void publishState()
+static void subscribeState(bool connected)
+{
+    char topic[sizeof(subcribedStatusTopic)];
+    getHaMQTTStateTopic(topic, sizeof(subcribedStateTopic));
+    strlcat(topic, "/set/#", sizeof(subcribedStateTopic));
+    subscribeTopic(subcribedStateTopic, sizeof(subcribedStateTopic), topic, connected);
+
+    // A retained "online" on every resubscribe would republish the config over and over
+    getHaMQTTStatusTopic(topic, sizeof(subcribedStatusTopic));
+    subscribeTopic(subcribedStatusTopic, sizeof(subcribedStatusTopic), topic, connected);
+}
+
+static void discoveryCacheLoad()
+{
+    if(nvsOpen(NVSGROUP, NVS_READONLY, &pHandle) == pdTRUE) {
+        // A cache of another output count does not load and everything is published
+        if (getBlobPref(pHandle, "mqtt.discovery", &discoveryCache, sizeof(discoveryCache)) != pdTRUE)
+            memset(&discoveryCache, 0, sizeof(discoveryCache));
+        nvs_close(pHandle);
+    }
+}
+
+static void discoveryCacheSave()
+{
+    discoveryCache_t cache;
+    taskENTER_CRITICAL(&discoveryLock);
+    cache = discoveryCache;
+    taskEXIT_CRITICAL(&discoveryLock);
+    if(nvsOpen(NVSGROUP, NVS_READWRITE, &pHandle) == pdTRUE) {
+        setBlobPref(pHandle, "mqtt.discovery", &cache, sizeof(cache));
+        nvs_close(pHandle);
+    }
+}
+
+/// @brief Cache entry of the slot, the caller holds discoveryLock
+static uint32_t *discoveryCached(uint8_t slot)
+{
+    if (slot == DISCOVERY_DEVICE_SLOT)
+        return &discoveryCache.device;
+    return &discoveryCache.outputs[slot / DISCOVERY_CLASSES][slot % DISCOVERY_CLASSES];
+}
+
+/// @brief Publish a discovery message at QoS 1 unless the broker retains it or it is on its way
+/// @return pdTRUE if published
+static BaseType_t discoveryPublish(uint8_t slot, const char *topic, const char *payload, size_t len, bool force)
+{
+    uint32_t hash = esp_rom_crc32_le(0, (const uint8_t *)topic, strlen(topic));
+    hash = esp_rom_crc32_le(hash, (const uint8_t *)payload, len);
+    discoveryPending_t *pending = &discoveryPending[slot];
+    taskENTER_CRITICAL(&discoveryLock);
+    bool known = *discoveryCached(slot) == hash || (pending->msgId != 0 && pending->hash == hash);
+    taskEXIT_CRITICAL(&discoveryLock);
+    if (!force && known)
+        return pdFALSE;
+    ESP_LOGI(TAG, "Publish a topic \"%s\" (%d bytes)", topic, len);
+    int msgId = esp_mqtt_client_publish(client, topic, payload, len, 1, 1);
+    if (msgId <= 0)
+        return pdFALSE;
+    bool save = false;
+    taskENTER_CRITICAL(&discoveryLock);
+    if (discoveryEarlyAck == msgId) {
+        // Acknowledged before the message id got here
+        discoveryEarlyAck = 0;
+        *discoveryCached(slot) = hash;
+        discoveryChanged = true;
+        if (pending->msgId != 0) {
+            pending->msgId = 0;
+            discoveryPendingCount--;
+        }
+        save = discoveryPendingCount == 0;
+    } else {
+        if (pending->msgId == 0)
+            discoveryPendingCount++;
+        pending->msgId = msgId;
+        pending->hash = hash;
+    }
+    if (save)
+        discoveryChanged = false;
+    taskEXIT_CRITICAL(&discoveryLock);
+    if (save)
+        discoveryCacheSave();
+    return pdTRUE;
+}
+
+/// @brief Move the hash of an acknowledged discovery into the cache, which is saved
+/// once no discovery waits for its acknowledge any more
+static void discoveryPublished(int msgId)
+{
+    bool save = false;
+    taskENTER_CRITICAL(&discoveryLock);
+    uint8_t slot = 0;
+    while (slot < DISCOVERY_SLOTS && discoveryPending[slot].msgId != msgId)
+        slot++;
+    if (slot < DISCOVERY_SLOTS) {
+        *discoveryCached(slot) = discoveryPending[slot].hash;
+        discoveryPending[slot].msgId = 0;
+        discoveryPendingCount--;
+        discoveryChanged = true;
+        save = discoveryPendingCount == 0;
+    } else {
+        // Only discoveries go out at QoS 1, this one is still in discoveryPublish()
+        discoveryEarlyAck = msgId;
+    }
+    if (save)
+        discoveryChanged = false;
+    taskEXIT_CRITICAL(&discoveryLock);
+    if (save)
+        discoveryCacheSave();
+}
+
+/// @brief Forget the discoveries waiting for an acknowledge, they are published again on connect
+static void discoveryPendingClear()
+{
+    taskENTER_CRITICAL(&discoveryLock);
+    memset(discoveryPending, 0, sizeof(discoveryPending));
+    discoveryPendingCount = 0;
+    discoveryEarlyAck = 0;
+    bool save = discoveryChanged;
+    discoveryChanged = false;
+    taskEXIT_CRITICAL(&discoveryLock);
+    if (save)
+        discoveryCacheSave();
+}
+
+/// @brief Publish the discovery message of an entity unless the broker already retains it
+/// @param clear publish an empty payload, which removes the entity
+/// @return pdTRUE if published
+static BaseType_t publishDiscovery(uint8_t num, uint8_t class, bool force, bool clear)
+{
+    char topic[64], payload[1024];
+    if (clear) {
+        getHaMQTTOutputConfigTopic(num, class, topic, sizeof(topic));
+        payload[0] = '\0';
+    }
+    else if(getHaMQTTOutputConfig(num, class, topic, sizeof(topic), payload, sizeof(payload)) != pdTRUE)
+        return pdFALSE;
+    return discoveryPublish(num * DISCOVERY_CLASSES + class - CLASS_SWITCH, topic, payload, strlen(payload), force);
+}
+
+/// @brief Publish the device-based discovery of all outputs unless the broker already retains it
+/// @param clear publish an empty payload, which removes the device components
+/// @return pdTRUE if published
+static BaseType_t publishDeviceDiscovery(bool force, bool clear)
+{
+    char topic[80];
+    size_t len = clear ? 0 : getHaMQTTDeviceDiscovery(topic, sizeof(topic), NULL, 0);
+    char *payload = malloc(len + 1);
+    if (payload == NULL) {
+        ESP_LOGE(TAG, "No memory for device discovery (%d bytes)", len);
+        return pdFALSE;
+    }
+    getHaMQTTDeviceDiscovery(topic, sizeof(topic), clear ? NULL : payload, len + 1);
+    payload[len] = '\0';
+    BaseType_t result = discoveryPublish(DISCOVERY_DEVICE_SLOT, topic, payload, len, force);
+    free(payload);
+    return result;
+}
+
+#if CONFIG_MQTT_DISCOVERY_BENCHMARK
+/// @brief Log messages and bytes of the per-entity and the device-based discovery
+static void discoveryBenchmark()
+{
+    char topic[80], payload[1024];
+    size_t entityBytes = 0;
+    for (uint8_t num = 0; num < OUT_PORTS; num++) {
+        for (uint8_t class = CLASS_SWITCH; class <= CLASS_SELECT; class++) {
+            if (getHaMQTTOutputConfig(num, class, topic, sizeof(topic), payload, sizeof(payload)) == pdTRUE)
+                entityBytes += strlen(topic) + strlen(payload);
+        }
+    }
+    size_t deviceBytes = getHaMQTTDeviceDiscovery(topic, sizeof(topic), NULL, 0) + strlen(topic);
+    ESP_LOGI(TAG, "Discovery of %d outputs: per entity %d messages %d bytes, device-based 1 message %d bytes",
+        OUT_PORTS, OUT_PORTS * DISCOVERY_CLASSES, entityBytes, deviceBytes);
+}
+#endif
+
+static void publishDeviceState()
 {
     char topic[64], payload[1024];
     if(getHaMQTTDeviceState(topic, sizeof(topic), payload, sizeof(payload)) == pdTRUE){
@@ -48,34 +274,144 @@ static void publishState()
     }
 }
 
-static void publishConfig()
+#if CONFIG_AM_MQTT_OUTPUT_STATE_TOPICS
+/// @brief Publish the topics of the outputs whose input differs from the retained one
+/// @param outputs mask of outputs to check
+/// @param force publish even if the retained input is the same
+static void publishOutputStates(uint32_t outputs, bool force)
 {
-    char topic[64], payload[1024];
+    char topic[80], payload[8];
+    device_t *pdevice = getDevice();
     for (uint8_t num = 0; num < OUT_PORTS; num++) {
-        if(getHaMQTTOutputConfig(num, CLASS_SWITCH, topic, sizeof(topic), payload, sizeof(payload)) == pdTRUE){
+        if ((outputs & (1u << num)) == 0)
+            continue;
+        int16_t input = pdevice->outputs[num].inputPort;
+        if (!force && publishedInputs[num] == input)
+            continue;
+        if (getHaMQTTOutputState(num, topic, sizeof(topic), payload, sizeof(payload)) == pdTRUE) {
             ESP_LOGI(TAG, "Publish a topic \"%s\"", topic);
-            esp_mqtt_client_publish(client, topic, payload, 0, 0, 1);
-        }
-        if(getHaMQTTOutputConfig(num, CLASS_SELECT, topic, sizeof(topic), payload, sizeof(payload)) == pdTRUE){
-            ESP_LOGI(TAG, "Publish a topic \"%s\"", topic);
-            esp_mqtt_client_publish(client, topic, payload, 0, 0, 1);
+            if (esp_mqtt_client_publish(client, topic, payload, 0, 0, 1) >= 0)
+                publishedInputs[num] = input;
         }
     }
-    subscribeState();
+}
+#endif
+
+static void publishState()
+{
+#if CONFIG_AM_MQTT_OUTPUT_STATE_TOPICS
+    publishOutputStates(atomic_exchange(&dirtyOutputs, 0), false);
+#if CONFIG_AM_MQTT_AGGREGATED_STATE
+    publishDeviceState();
+#endif
+#else
+    publishDeviceState();
+#endif
+}
+
+static void publishWear()
+{
+    wearPublishAt = esp_timer_get_time() + WEAR_PUBLISH_PERIOD_US;
+    char topic[80];
+    getHaMQTTStateTopic(topic, sizeof(topic));
+    strlcat(topic, "/wear", sizeof(topic));
+    const char *payload = getJsonRelayWear();
+    if (payload != NULL) {
+        ESP_LOGI(TAG, "Publish a topic \"%s\"", topic);
+        esp_mqtt_client_publish(client, topic, payload, 0, 0, 1);
+        free((void *)payload);
+    }
+}
+
+static void publishConfig()
+{
+    bool force = atomic_exchange(&discoveryForce, false);
+    uint8_t published = 0;
+#if CONFIG_MQTT_DISCOVERY_BENCHMARK
+    discoveryBenchmark();
+#endif
+#if CONFIG_AM_MQTT_DEVICE_DISCOVERY
+    // Entities announced per entity before are cleared once, the cache keeps them empty
+    for (uint8_t num = 0; num < OUT_PORTS; num++) {
+        published += publishDiscovery(num, CLASS_SWITCH, false, true);
+        published += publishDiscovery(num, CLASS_SELECT, false, true);
+    }
+    published += publishDeviceDiscovery(force, false);
+    ESP_LOGI(TAG, "Discovery: device-based, %d messages published", published);
+#else
+    // A device-based discovery left from an earlier config would duplicate the entities
+    published += publishDeviceDiscovery(false, true);
+    for (uint8_t num = 0; num < OUT_PORTS; num++) {
+        published += publishDiscovery(num, CLASS_SWITCH, force, false);
+        published += publishDiscovery(num, CLASS_SELECT, force, false);
+    }
+    ESP_LOGI(TAG, "Discovery: %d of %d messages published", published, OUT_PORTS * DISCOVERY_CLASSES + 1);
+#endif
+    subscribeState(false);
+#if CONFIG_AM_MQTT_OUTPUT_STATE_TOPICS
+    atomic_store(&dirtyOutputs, 0);
+    publishOutputStates(ALL_OUTPUTS, true);
+#endif
+    publishDeviceState();
+    publishWear();
+}
+
+static void publishStateNow(int64_t now)
+{
     publishState();
+    statePublishedAt = now;
+    atomic_fetch_add(&statePublished, 1);
+}
+
+/// @brief Publish a change at once unless the window of the last publish is still open
+static void stateChanged(int64_t now)
+{
+    if (statePendingSince != 0)
+        return;
+    if (now - statePublishedAt >= STATE_COALESCE_WINDOW_US)
+        publishStateNow(now);
+    else
+        statePendingSince = now;
+}
+
+/// @brief Trailing publish of the changes folded at the end of the window
+static void stateWindowExpired(int64_t now)
+{
+    if (statePendingSince == 0 || now - statePublishedAt < STATE_COALESCE_WINDOW_US)
+        return;
+    uint32_t delay = now - statePendingSince;
+    statePendingSince = 0;
+    publishStateNow(now);
+    atomic_fetch_add(&stateTrailing, 1);
+    atomic_fetch_add(&stateDelayTotal, delay);
+    if (delay > atomic_load(&stateDelayMax))
+        atomic_store(&stateDelayMax, delay);
 }
 
 static void audiomatrixEventTask(void *pvParameters) 
 {
+    wearPublishAt = esp_timer_get_time() + WEAR_PUBLISH_PERIOD_US;
     while (1) {
+        int64_t now = esp_timer_get_time();
+        int64_t wakeAt = wearPublishAt;
+        if (statePendingSince != 0 && statePublishedAt + STATE_COALESCE_WINDOW_US < wakeAt)
+            wakeAt = statePublishedAt + STATE_COALESCE_WINDOW_US;
+        // Round up: waking before the window ends only spins once more
+        TickType_t ticks = wakeAt > now ? pdMS_TO_TICKS((uint32_t)((wakeAt - now + 999) / 1000)) + 1 : 0;
         EventBits_t bits = xEventGroupWaitBits(xEventGroup,
             SUBSCRIBE_STATE_BIT | PUBLISH_STATE_BIT | PUBLISH_CONFIG_BIT,
             pdTRUE,
             pdFALSE,
-            portMAX_DELAY);
-            
-        if (bits & SUBSCRIBE_STATE_BIT) subscribeState();
-        if (bits & PUBLISH_STATE_BIT) publishState();
+            ticks);
+
+        now = esp_timer_get_time();
+        if (now >= wearPublishAt) {
+            if (mqttState == HOME_MQTT_CONNECTED) publishWear();
+            else wearPublishAt = now + WEAR_PUBLISH_PERIOD_US;
+        }
+        if (bits & SUBSCRIBE_STATE_BIT) subscribeState(true);
+        if (bits & PUBLISH_STATE_BIT) stateChanged(now);
+        stateWindowExpired(now);
         if (bits & PUBLISH_CONFIG_BIT) publishConfig();
     }
 }
@@ -90,6 +426,19 @@ static void audiomatrixEventHandler(void* arg, esp_event_base_t event_base,
 
     switch ((audiomatrix_event_t)event_id) {
         case AUDIOMATRIX_EVENT_PORT_CHANGED:
+#if CONFIG_AM_MQTT_OUTPUT_STATE_TOPICS
+            if (event_data != NULL)
+                atomic_fetch_or(&dirtyOutputs, 1u << ((audiomatrixPortChange_t *)event_data)->output);
+#endif
+            atomic_fetch_add(&stateChanges, 1);
+            xEventGroupSetBits(xEventGroup, PUBLISH_STATE_BIT);
+            break;
+        case AUDIOMATRIX_EVENT_PORTS_CHANGED:
+#if CONFIG_AM_MQTT_OUTPUT_STATE_TOPICS
+            if (event_data != NULL)
+                atomic_fetch_or(&dirtyOutputs, ((audiomatrixPortsChange_t *)event_data)->outputs);
+#endif
+            atomic_fetch_add(&stateChanges, 1);
             xEventGroupSetBits(xEventGroup, PUBLISH_STATE_BIT);
             break;
         case AUDIOMATRIX_EVENT_CONFIG_CHANGED:
@@ -119,6 +468,7 @@ static void mqttEventHandler(void *handler_args, esp_event_base_t base, int32_t
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
         mqttState = HOME_MQTT_DISCONNECTED;
+        discoveryPendingClear();
     /*
         if (s_retry_num < MQTT_MAXIMUM_RETRY) {
             s_retry_num++; 
@@ -139,9 +489,18 @@ static void mqttEventHandler(void *handler_args, esp_event_base_t base, int32_t
         break;
     case MQTT_EVENT_PUBLISHED:
         ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        discoveryPublished(event->msg_id);
         break;
     case MQTT_EVENT_DATA:
         ESP_LOGI(TAG, "MQTT_EVENT_DATA");
+        if (event->topic_len == strlen(subcribedStatusTopic) && strncmp(event->topic, subcribedStatusTopic, event->topic_len) == 0) {
+            // Home Assistant birth message: it may have lost the retained discovery
+            if (event->data_len == 6 && strncmp(event->data, "online", 6) == 0) {
+                atomic_store(&discoveryForce, true);
+                xEventGroupSetBits(xEventGroup, PUBLISH_CONFIG_BIT);
+            }
+            break;
+        }
         setHaMQTTOutput(event->topic, event->topic_len, event->data, event->data_len);
         break;
     case MQTT_EVENT_ERROR:
@@ -237,6 +596,16 @@ mqttConfig_t * getMqttConfig()
 {
     return &mqttConfig;
 }
+void mqttStatePublishStats(mqttStatePublishStats_t *stats)
+{
+    stats->published = atomic_load(&statePublished);
+    stats->changes = atomic_load(&stateChanges);
+    stats->coalesced = stats->changes > stats->published ? stats->changes - stats->published : 0;
+    stats->trailing = atomic_load(&stateTrailing);
+    stats->delayTotal = atomic_load(&stateDelayTotal);
+    stats->delayMax = atomic_load(&stateDelayMax);
+}
+
 const char * getJsonMqttConfig()
 {
     // payload
@@ -248,6 +617,16 @@ const char * getJsonMqttConfig()
     cJSON_AddStringToObject(config, "username", mqttConfig.username); 
     cJSON_AddStringToObject(config, "password", mqttConfig.password); 
     cJSON_AddNumberToObject(root, "state", mqttState);
+    mqttStatePublishStats_t stats;
+    mqttStatePublishStats(&stats);
+    cJSON *statePublish = cJSON_AddObjectToObject(root, "statePublish");
+    cJSON_AddNumberToObject(statePublish, "window", CONFIG_MQTT_STATE_COALESCE_WINDOW);
+    cJSON_AddNumberToObject(statePublish, "changes", stats.changes);
+    cJSON_AddNumberToObject(statePublish, "published", stats.published);
+    cJSON_AddNumberToObject(statePublish, "coalesced", stats.coalesced);
+    cJSON_AddNumberToObject(statePublish, "trailing", stats.trailing);
+    cJSON_AddNumberToObject(statePublish, "delayTotal", stats.delayTotal);
+    cJSON_AddNumberToObject(statePublish, "delayMax", stats.delayMax);
 
     char *jsonConfig = cJSON_Print(root);
     cJSON_Delete(root);
@@ -281,7 +660,14 @@ BaseType_t saveMqttConfig(mqttConfig_t *pMqttConfig)
         ESP_LOGW(TAG, "Failed saving mqtt config");
         return pdFALSE;
     }
+    // The retained discovery of the old broker says nothing about the new one
+    bool brokerChanged = strcmp(mqttConfig.host, pMqttConfig->host) != 0 || mqttConfig.port != pMqttConfig->port;
     nvsOpen(NVSGROUP, NVS_READWRITE, &pHandle);
+    if (brokerChanged) {
+        static const discoveryCache_t emptyCache = {0};
+        setBlobPref(pHandle, "mqtt.discovery", &emptyCache, sizeof(emptyCache));
+        atomic_store(&discoveryForce, true);
+    }
     setStrPref(pHandle, "mqtt.protocol", "mqtt://");
     setStrPref(pHandle, "mqtt.host", pMqttConfig->host);
     setUInt32Pref(pHandle, "mqtt.port", pMqttConfig->port);
@@ -330,6 +716,8 @@ void mqttClientInit(void)
         mqttConfigure();
     }
 
+    discoveryCacheLoad();
+
     static StaticEventGroup_t xEventGroupBuffer;
     xEventGroup = xEventGroupCreateStatic(&xEventGroupBuffer);
 
@@ -341,12 +729,13 @@ void mqttClientInit(void)
     }
 
     //ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &connectHandler, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_register(HOME_WIFI_EVENT, HOME_WIFI_EVENT_START, &connectHandler, NULL));
+    ESP_ERROR_CHECK(eventsHandlerRegister(HOME_WIFI_EVENT, HOME_WIFI_EVENT_START, &connectHandler, NULL));
     //ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &disconnectHandler, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_register(HOME_WIFI_EVENT, HOME_WIFI_EVENT_STOP, &disconnectHandler, NULL));
+    ESP_ERROR_CHECK(eventsHandlerRegister(HOME_WIFI_EVENT, HOME_WIFI_EVENT_STOP, &disconnectHandler, NULL));
     
-    ESP_ERROR_CHECK(esp_event_handler_register(AUDIOMATRIX_EVENT, AUDIOMATRIX_EVENT_PORT_CHANGED, &audiomatrixEventHandler, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_register(AUDIOMATRIX_EVENT, AUDIOMATRIX_EVENT_CONFIG_CHANGED, &audiomatrixEventHandler, NULL));
+    ESP_ERROR_CHECK(audiomatrixEventHandlerRegister(AUDIOMATRIX_EVENT_PORT_CHANGED, &audiomatrixEventHandler, NULL));
+    ESP_ERROR_CHECK(audiomatrixEventHandlerRegister(AUDIOMATRIX_EVENT_PORTS_CHANGED, &audiomatrixEventHandler, NULL));
+    ESP_ERROR_CHECK(audiomatrixEventHandlerRegister(AUDIOMATRIX_EVENT_CONFIG_CHANGED, &audiomatrixEventHandler, NULL));
 
     ESP_LOGI(TAG, "MQTT init finished.");
 }
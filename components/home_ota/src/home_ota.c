@@ -512,5 +512,5 @@ void otaInit(void)
     }
 #endif
 
-    ESP_ERROR_CHECK(esp_event_handler_register(HOME_WIFI_EVENT, HOME_WIFI_EVENT_START, &connectHandler, NULL));
+    ESP_ERROR_CHECK(eventsHandlerRegister(HOME_WIFI_EVENT, HOME_WIFI_EVENT_START, &connectHandler, NULL));
 }
\ No newline at end of file
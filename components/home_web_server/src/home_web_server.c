@@ -15,6 +15,7 @@
 #include "home_wifi.h"
 #include "home_mqtt_client.h"
 #include "home_ota.h"
+#include "matrix_relay.h"
 
 static const char *TAG = "home_web_server";
 
@@ -412,6 +413,48 @@ static BaseType_t updatePostHandler(httpd_req_t *req)
     return responseReleasesInfo(req);
 }
 
+static BaseType_t relayTraceGetHandler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "uri: %s", req->uri);
+    const char *jsonRelayTrace = getJsonRelayTrace();
+    if (jsonRelayTrace == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, JSON_Message("No memory for relay trace"));
+        return pdFALSE;
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, jsonRelayTrace);
+    free((void *)jsonRelayTrace);
+    return pdTRUE;
+}
+
+static BaseType_t eventsProfileGetHandler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "uri: %s", req->uri);
+    const char *jsonEventsProfile = getJsonEventsProfile();
+    if (jsonEventsProfile == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, JSON_Message("No memory for events profile"));
+        return pdFALSE;
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, jsonEventsProfile);
+    free((void *)jsonEventsProfile);
+    return pdTRUE;
+}
+
+static BaseType_t relayWearGetHandler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "uri: %s", req->uri);
+    const char *jsonRelayWear = getJsonRelayWear();
+    if (jsonRelayWear == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, JSON_Message("No memory for relay wear"));
+        return pdFALSE;
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, jsonRelayWear);
+    free((void *)jsonRelayWear);
+    return pdTRUE;
+}
+
 static BaseType_t systemInfoGetHandler(httpd_req_t *req)
 {
     ESP_LOGI(TAG, "uri: %s", req->uri);
@@ -444,7 +487,7 @@ static BaseType_t startWebServer(const char *base_path)
     
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.stack_size = 8192;
-    config.max_uri_handlers = 16;
+    config.max_uri_handlers = 24;
     config.lru_purge_enable = true;
     config.uri_match_fn = httpd_uri_match_wildcard;
 
@@ -552,6 +595,30 @@ static BaseType_t startWebServer(const char *base_path)
     };
     httpd_register_uri_handler(server, &updatePostUri);
 
+    httpd_uri_t relayTraceGetUri = {
+        .uri = "/api/v1/relay/trace",
+        .method = HTTP_GET,
+        .handler = relayTraceGetHandler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &relayTraceGetUri);
+
+    httpd_uri_t relayWearGetUri = {
+        .uri = "/api/v1/relay/wear",
+        .method = HTTP_GET,
+        .handler = relayWearGetHandler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &relayWearGetUri);
+
+    httpd_uri_t eventsProfileGetUri = {
+        .uri = "/api/v1/events/profile",
+        .method = HTTP_GET,
+        .handler = eventsProfileGetHandler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &eventsProfileGetUri);
+
     httpd_uri_t systemInfoGetUri = {
         .uri = "/api/v1/system/info",
         .method = HTTP_GET,
@@ -649,8 +716,8 @@ void webServerInit(void)
         return;
     }
     //ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &connectHandler, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_register(HOME_WIFI_EVENT, HOME_WIFI_EVENT_START, &connectHandler, NULL));
+    ESP_ERROR_CHECK(eventsHandlerRegister(HOME_WIFI_EVENT, HOME_WIFI_EVENT_START, &connectHandler, NULL));
     //ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &disconnectHandler, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_register(HOME_WIFI_EVENT, HOME_WIFI_EVENT_STOP, &disconnectHandler, NULL));
+    ESP_ERROR_CHECK(eventsHandlerRegister(HOME_WIFI_EVENT, HOME_WIFI_EVENT_STOP, &disconnectHandler, NULL));
     ESP_LOGI(TAG, "Webserver init finished.");
 }
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include "nvs_preferences.h"
 #include "home_json.h"
 #include "home_wifi.h"
+#include "events_types.h"
 #include "time_sync.h"
 
 ESP_EVENT_DEFINE_BASE(HOME_WIFI_EVENT);
@@ -96,7 +97,7 @@ static void initializeNetbiosns(const char *hostname)
 
 static void eventPost(int32_t eventId)
 {
-    esp_err_t err = esp_event_post(HOME_WIFI_EVENT, eventId, NULL, 0, portMAX_DELAY);
+    esp_err_t err = eventsPost(HOME_WIFI_EVENT, eventId, NULL, 0, EVENTS_POST_TICKS);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to post event to \"%s\" #%ld: %d (%s)", HOME_WIFI_EVENT, eventId, err, esp_err_to_name(err));
     };
@@ -2,16 +2,25 @@
 #ifndef __MATRIX_LCD_H__
 #define __MATRIX_LCD_H__
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "matrix_lcd_types.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-
 void lcdSetCursor(uint8_t col, uint8_t row);
 void lcdHome(void);
 void lcdClearScreen(void);
 void lcdWriteChar(char c);
 void lcdWriteStr(const char* str); 
+void lcdWriteRegion(uint8_t col, uint8_t row, const char *str);
+void lcdWriteFrame(const char *text);
+void lcdFlush(void);
+void lcdLayoutShow(uint8_t count);
+void lcdLayoutSetItem(uint8_t index, const char *text, bool highlight);
 void matrixLcdInit(void);
 
 #ifdef __cplusplus
@@ -2,11 +2,23 @@
 #ifndef __MATRIX_LCD_TYPES_H__
 #define __MATRIX_LCD_TYPES_H__
 
+#include "sdkconfig.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 // LCD module defines
+#if CONFIG_LCD_GEOMETRY_20X4
+#define LCD_COLS                20
+#define LCD_ROWS                4
+#else
+#define LCD_COLS                16
+#define LCD_ROWS                2
+#endif
+// Layout: two cells per row, the first column of a cell holds the highlight mark
+#define LCD_LAYOUT_CELL_WIDTH   (LCD_COLS / 2)
+#define LCD_LAYOUT_ITEM_WIDTH   (LCD_LAYOUT_CELL_WIDTH - 1)
 #define LCD_LINEONE             0x00        // start of line 1
 #define LCD_LINETWO             0x40        // start of line 2
 #define LCD_LINETHREE           0x14        // start of line 3
@@ -18,6 +30,8 @@ extern "C" {
 #define LCD_WRITE               0x01
 
 #define LCD_SET_DDRAM_ADDR      0x80
+#define LCD_SET_CGRAM_ADDR      0x40
+#define LCD_CGRAM_SLOTS         8           // user defined characters 0x00-0x07
 #define LCD_READ_BF             0x40
 
 // LCD instructions
@@ -1,9 +1,14 @@
 #include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "rom/ets_sys.h"
 #include "driver/i2c_master.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "matrix_lcd.h"
 #include "matrix_lcd_types.h"
 
@@ -12,35 +17,375 @@ static const char *TAG = "matrix_lcd";
 #define PIN_NUM_SDA CONFIG_PIN_NUM_SDA
 #define PIN_NUM_SCL CONFIG_PIN_NUM_SCL
 #define I2C_PORT I2C_NUM_0
-#define CLOCK_SPEED_HZ (100000) // 100 KHz
+#define CLOCK_SPEED_HZ CONFIG_LCD_I2C_CLOCK_HZ
+#define I2C_TIMEOUT_MS 100
+#define BURST_SIZE 240 // 3 bytes per nibble, 40 characters per transaction
 
 #define LCD_ADDR                0x27
-#define LCD_COLS                16
-#define LCD_ROWS                2
+#define MUTEX_TAKE_TICK_PERIOD 1000 / portTICK_PERIOD_MS
+#define REFRESH_TICK_PERIOD (CONFIG_LCD_REFRESH_PERIOD / portTICK_PERIOD_MS)
+#define STACK_SIZE 3072
+
+#define TAB_SIZE 8
+#define LAYOUT_CELLS_PER_ROW (LCD_COLS / LCD_LAYOUT_CELL_WIDTH)
+#define LAYOUT_CELL_WIDTH LCD_LAYOUT_CELL_WIDTH
+#define LAYOUT_ITEM_WIDTH LCD_LAYOUT_ITEM_WIDTH
+#define LAYOUT_ITEMS_PER_PAGE (LCD_ROWS * LAYOUT_CELLS_PER_ROW)
+#define LAYOUT_MAX_ITEMS CONFIG_LCD_LAYOUT_MAX_ITEMS
+#define LAYOUT_NO_HIGHLIGHT 0xFF
+#define PAGE_PERIOD_US (CONFIG_LCD_PAGE_PERIOD * 1000LL)
+#define CYRILLIC_FIRST 0x0410 // А
+#define CYRILLIC_LAST 0x044F  // я
+#define CYRILLIC_IO 0x0401    // Ё
+#define CYRILLIC_SMALL_IO 0x0451 // ё
+
+typedef struct {
+    char rom;           // character of the ROM font, 0 if the glyph needs a CGRAM slot
+    char fallback;      // shown when every CGRAM slot holds a glyph of the visible screen
+    uint8_t bitmap[8];  // 5x8 pattern loaded into CGRAM
+} lcdGlyph_t;
+
+typedef enum {
+    LCD_INIT_POWER_UP,
+    LCD_INIT_RESET_1,
+    LCD_INIT_RESET_2,
+    LCD_INIT_RESET_3,
+    LCD_INIT_4BIT,
+    LCD_INIT_CLEAR,
+    LCD_INIT_ENTRY_MODE,
+    LCD_INIT_DONE
+} lcdInitState_t;
+
+typedef struct {
+    uint16_t codepoint; // 0 if the slot is empty
+    uint32_t lastUsed;  // number of the last frame that showed the glyph
+} cgramSlot_t;
+
+// Cyrillic letters look-alike to Latin ones come from the ROM font (A00, no Cyrillic),
+// the rest are drawn into the CGRAM slots on demand
+static const lcdGlyph_t cyrillicGlyphs[CYRILLIC_LAST - CYRILLIC_FIRST + 1] = {
+    {'A', 0, {0}}, // А
+    {0, '6', {0b11111, 0b10000, 0b10000, 0b11110, 0b10001, 0b10001, 0b11110, 0b00000}}, // Б
+    {'B', 0, {0}}, // В
+    {0, 'r', {0b11111, 0b10000, 0b10000, 0b10000, 0b10000, 0b10000, 0b10000, 0b00000}}, // Г
+    {0, 'D', {0b00110, 0b01010, 0b01010, 0b01010, 0b01010, 0b11111, 0b10001, 0b00000}}, // Д
+    {'E', 0, {0}}, // Е
+    {0, '*', {0b10101, 0b10101, 0b10101, 0b01110, 0b10101, 0b10101, 0b10101, 0b00000}}, // Ж
+    {0, '3', {0b01110, 0b10001, 0b00001, 0b00110, 0b00001, 0b10001, 0b01110, 0b00000}}, // З
+    {0, 'N', {0b10001, 0b10001, 0b10011, 0b10101, 0b11001, 0b10001, 0b10001, 0b00000}}, // И
+    {0, 'N', {0b01010, 0b00100, 0b10001, 0b10011, 0b10101, 0b11001, 0b10001, 0b00000}}, // Й
+    {'K', 0, {0}}, // К
+    {0, 'J', {0b00111, 0b01001, 0b01001, 0b01001, 0b01001, 0b01001, 0b10001, 0b00000}}, // Л
+    {'M', 0, {0}}, // М
+    {'H', 0, {0}}, // Н
+    {'O', 0, {0}}, // О
+    {0, 'n', {0b11111, 0b10001, 0b10001, 0b10001, 0b10001, 0b10001, 0b10001, 0b00000}}, // П
+    {'P', 0, {0}}, // Р
+    {'C', 0, {0}}, // С
+    {'T', 0, {0}}, // Т
+    {0, 'Y', {0b10001, 0b10001, 0b10001, 0b01111, 0b00001, 0b10001, 0b01110, 0b00000}}, // У
+    {0, 'o', {0b00100, 0b01110, 0b10101, 0b10101, 0b10101, 0b01110, 0b00100, 0b00000}}, // Ф
+    {'X', 0, {0}}, // Х
+    {0, 'U', {0b10010, 0b10010, 0b10010, 0b10010, 0b10010, 0b10010, 0b11111, 0b00001}}, // Ц
+    {0, '4', {0b10001, 0b10001, 0b10001, 0b01111, 0b00001, 0b00001, 0b00001, 0b00000}}, // Ч
+    {0, 'W', {0b10101, 0b10101, 0b10101, 0b10101, 0b10101, 0b10101, 0b11111, 0b00000}}, // Ш
+    {0, 'W', {0b10101, 0b10101, 0b10101, 0b10101, 0b10101, 0b10101, 0b11111, 0b00001}}, // Щ
+    {0, 'b', {0b11000, 0b01000, 0b01000, 0b01110, 0b01001, 0b01001, 0b01110, 0b00000}}, // Ъ
+    {0, 'b', {0b10001, 0b10001, 0b10001, 0b11001, 0b10101, 0b10101, 0b11001, 0b00000}}, // Ы
+    {0, 'b', {0b10000, 0b10000, 0b10000, 0b11110, 0b10001, 0b10001, 0b11110, 0b00000}}, // Ь
+    {0, '3', {0b01110, 0b10001, 0b00001, 0b00111, 0b00001, 0b10001, 0b01110, 0b00000}}, // Э
+    {0, '0', {0b10010, 0b10101, 0b10101, 0b11101, 0b10101, 0b10101, 0b10010, 0b00000}}, // Ю
+    {0, 'R', {0b01111, 0b10001, 0b10001, 0b01111, 0b00101, 0b01001, 0b10001, 0b00000}}, // Я
+    {'a', 0, {0}}, // а
+    {0, '6', {0b00011, 0b01100, 0b10000, 0b11110, 0b10001, 0b10001, 0b01110, 0b00000}}, // б
+    {0, 'B', {0b00000, 0b00000, 0b11110, 0b10001, 0b11110, 0b10001, 0b11110, 0b00000}}, // в
+    {0, 'r', {0b00000, 0b00000, 0b11111, 0b10000, 0b10000, 0b10000, 0b10000, 0b00000}}, // г
+    {0, 'g', {0b00000, 0b00000, 0b00110, 0b01010, 0b01010, 0b11111, 0b10001, 0b00000}}, // д
+    {'e', 0, {0}}, // е
+    {0, '*', {0b00000, 0b00000, 0b10101, 0b10101, 0b01110, 0b10101, 0b10101, 0b00000}}, // ж
+    {0, '3', {0b00000, 0b00000, 0b01110, 0b10001, 0b00110, 0b10001, 0b01110, 0b00000}}, // з
+    {0, 'u', {0b00000, 0b00000, 0b10001, 0b10011, 0b10101, 0b11001, 0b10001, 0b00000}}, // и
+    {0, 'u', {0b01010, 0b00100, 0b10001, 0b10011, 0b10101, 0b11001, 0b10001, 0b00000}}, // й
+    {0, 'k', {0b00000, 0b00000, 0b10010, 0b10100, 0b11000, 0b10100, 0b10010, 0b00000}}, // к
+    {0, 'n', {0b00000, 0b00000, 0b00111, 0b01001, 0b01001, 0b01001, 0b10001, 0b00000}}, // л
+    {0, 'm', {0b00000, 0b00000, 0b10001, 0b11011, 0b10101, 0b10001, 0b10001, 0b00000}}, // м
+    {0, 'H', {0b00000, 0b00000, 0b10001, 0b10001, 0b11111, 0b10001, 0b10001, 0b00000}}, // н
+    {'o', 0, {0}}, // о
+    {0, 'n', {0b00000, 0b00000, 0b11111, 0b10001, 0b10001, 0b10001, 0b10001, 0b00000}}, // п
+    {'p', 0, {0}}, // р
+    {'c', 0, {0}}, // с
+    {0, 'T', {0b00000, 0b00000, 0b11111, 0b00100, 0b00100, 0b00100, 0b00100, 0b00000}}, // т
+    {'y', 0, {0}}, // у
+    {0, 'o', {0b00100, 0b00100, 0b01110, 0b10101, 0b01110, 0b00100, 0b00100, 0b00000}}, // ф
+    {'x', 0, {0}}, // х
+    {0, 'u', {0b00000, 0b00000, 0b10010, 0b10010, 0b10010, 0b10010, 0b11111, 0b00001}}, // ц
+    {0, '4', {0b00000, 0b00000, 0b10001, 0b10001, 0b01111, 0b00001, 0b00001, 0b00000}}, // ч
+    {0, 'w', {0b00000, 0b00000, 0b10101, 0b10101, 0b10101, 0b10101, 0b11111, 0b00000}}, // ш
+    {0, 'w', {0b00000, 0b00000, 0b10101, 0b10101, 0b10101, 0b10101, 0b11111, 0b00001}}, // щ
+    {0, 'b', {0b00000, 0b00000, 0b11000, 0b01000, 0b01110, 0b01001, 0b01110, 0b00000}}, // ъ
+    {0, 'b', {0b00000, 0b00000, 0b10001, 0b10001, 0b11001, 0b10101, 0b11001, 0b00000}}, // ы
+    {0, 'b', {0b00000, 0b00000, 0b10000, 0b10000, 0b11110, 0b10001, 0b11110, 0b00000}}, // ь
+    {0, '3', {0b00000, 0b00000, 0b01110, 0b10001, 0b00111, 0b10001, 0b01110, 0b00000}}, // э
+    {0, 'o', {0b00000, 0b00000, 0b10010, 0b10101, 0b11101, 0b10101, 0b10010, 0b00000}}, // ю
+    {0, 'R', {0b00000, 0b00000, 0b01111, 0b10001, 0b01111, 0b00101, 0b01001, 0b00000}}, // я
+};
 
 static i2c_master_dev_handle_t i2cDevice = NULL;
+static SemaphoreHandle_t xMutex;
 
-static void lcdPulseEnable(uint8_t data)
+// Desired screen content as Unicode code points and the bytes the HD44780 currently shows
+static uint16_t lcdFrame[LCD_ROWS][LCD_COLS];
+static uint8_t lcdShadow[LCD_ROWS][LCD_COLS];
+static uint8_t cursorCol = 0, cursorRow = 0; // write position in lcdFrame
+static const uint8_t rowOffsets[] = {LCD_LINEONE, LCD_LINETWO, LCD_LINETHREE, LCD_LINEFOUR};
+static cgramSlot_t cgramSlots[LCD_CGRAM_SLOTS];
+static uint32_t cgramWrites = 0;
+static uint8_t burstBuf[BURST_SIZE];
+static size_t burstLen = 0;
+static TaskHandle_t xRenderTask = NULL;
+static atomic_uint renderRequests = 0;  // lcdFlush() calls of every producer
+static uint32_t renderFrames = 0;       // render task only
+static int64_t initStartTime = 0;
+
+// Items of the paged layout, shown while layoutActive
+static uint16_t layoutItems[LAYOUT_MAX_ITEMS][LAYOUT_ITEM_WIDTH];
+static uint8_t layoutCount = 0, layoutPage = 0, layoutHighlight = LAYOUT_NO_HIGHLIGHT;
+static bool layoutActive = false;
+static esp_timer_handle_t pageTimer = NULL;
+
+/// @brief Decode the next UTF-8 character and advance the string.
+/// Malformed sequences and characters outside the BMP are returned as '?'.
+static uint16_t utf8Next(const char **str)
 {
-    uint8_t buf = data | LCD_ENABLE;
-    i2c_master_transmit(i2cDevice, &buf, 1, -1);
-    ets_delay_us(1);
-    buf = data & ~LCD_ENABLE;
-    i2c_master_transmit(i2cDevice, &buf, 1, -1);
-    ets_delay_us(500);
+    const uint8_t *s = (const uint8_t *)*str;
+    uint16_t codepoint = '?';
+    size_t len = 1;
+    if (s[0] < 0x80) {
+        codepoint = s[0];
+    } else if ((s[0] & 0xE0) == 0xC0 && (s[1] & 0xC0) == 0x80) {
+        codepoint = ((s[0] & 0x1F) << 6) | (s[1] & 0x3F);
+        len = 2;
+    } else if ((s[0] & 0xF0) == 0xE0 && (s[1] & 0xC0) == 0x80 && (s[2] & 0xC0) == 0x80) {
+        codepoint = ((s[0] & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+        len = 3;
+    } else {
+        // skip the continuation bytes of the broken character
+        while ((s[len] & 0xC0) == 0x80) len++;
+    }
+    *str += len;
+    return codepoint;
 }
 
-static void lcdWriteNibble(uint8_t nibble, uint8_t mode)
+/// @brief Glyph that has to be drawn into CGRAM, NULL for ROM characters
+static const lcdGlyph_t *lcdCgramGlyph(uint16_t codepoint)
+{
+    if (codepoint < CYRILLIC_FIRST || codepoint > CYRILLIC_LAST)
+        return NULL;
+    const lcdGlyph_t *glyph = &cyrillicGlyphs[codepoint - CYRILLIC_FIRST];
+    return glyph->rom ? NULL : glyph;
+}
+
+static uint8_t lcdRomChar(uint16_t codepoint)
 {
+    if (codepoint < 0x20)
+        return ' ';
+    if (codepoint < 0x80)
+        return codepoint;
+    if (codepoint == CYRILLIC_IO)
+        return 'E';
+    if (codepoint == CYRILLIC_SMALL_IO)
+        return 'e';
+    if (codepoint >= CYRILLIC_FIRST && codepoint <= CYRILLIC_LAST)
+        return cyrillicGlyphs[codepoint - CYRILLIC_FIRST].rom;
+    return '?';
+}
+
+static void lcdBurstSend(void)
+{
+    if (burstLen == 0)
+        return;
+    esp_err_t err = i2c_master_transmit(i2cDevice, burstBuf, burstLen, I2C_TIMEOUT_MS);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed i2c transmit, err: %d (%s)", err, esp_err_to_name(err));
+    }
+    burstLen = 0;
+}
+
+/// @brief Append data, data|EN, data to the burst buffer. Each PCF8574 byte takes
+/// 9 SCL periods, so the bus itself times the enable pulse and the 37us execution
+/// time of the previous instruction, no busy-wait is needed between characters.
+static void lcdBurstNibble(uint8_t nibble, uint8_t mode)
+{
+    if (burstLen + 3 > BURST_SIZE)
+        lcdBurstSend();
     uint8_t data = (nibble & 0xF0) | mode | LCD_BACKLIGHT;
-    i2c_master_transmit(i2cDevice, &data, 1, -1);   
-    lcdPulseEnable(data);                                              // Clock data into LCD
+    burstBuf[burstLen++] = data;
+    burstBuf[burstLen++] = data | LCD_ENABLE;                          // Clock data into LCD
+    burstBuf[burstLen++] = data;
+}
+
+static void lcdWriteNibble(uint8_t nibble, uint8_t mode)
+{
+    lcdBurstNibble(nibble, mode);
+    lcdBurstSend();
 }
 
 static void lcdWriteByte(uint8_t data, uint8_t mode)
 {
-    lcdWriteNibble(data & 0xF0, mode);
-    lcdWriteNibble((data << 4) & 0xF0, mode);
+    lcdBurstNibble(data & 0xF0, mode);
+    lcdBurstNibble((data << 4) & 0xF0, mode);
+}
+
+/// @brief Send the cells that differ from the shadow framebuffer.
+/// The DDRAM address auto-increments, so the cursor is only moved across gaps
+/// of unchanged cells that are longer than one set-address command.
+static void lcdFlushFrame(const uint8_t frame[LCD_ROWS][LCD_COLS])
+{
+    for (uint8_t row = 0; row < LCD_ROWS; row++) {
+        int8_t hwCol = -1; // DDRAM address is not on this row
+        for (uint8_t col = 0; col < LCD_COLS; col++) {
+            if (frame[row][col] == lcdShadow[row][col])
+                continue;
+            if (hwCol < 0 || col - hwCol > 1) {
+                lcdWriteByte(LCD_SET_DDRAM_ADDR | (col + rowOffsets[row]), LCD_COMMAND);
+                hwCol = col;
+            }
+            // bridge a single unchanged cell instead of moving the cursor
+            for (; hwCol <= col; hwCol++) {
+                lcdWriteByte(frame[row][hwCol], LCD_WRITE);
+                lcdShadow[row][hwCol] = frame[row][hwCol];
+            }
+        }
+    }
+    lcdBurstSend();
+}
+
+/// @brief Return the CGRAM slot holding the glyph, loading it into the least
+/// recently used slot that the frame being rendered does not need.
+/// @return slot number or LCD_CGRAM_SLOTS if every slot is in use by this frame
+static uint8_t lcdCgramLoad(uint16_t codepoint, const lcdGlyph_t *glyph, uint32_t frameNum, uint8_t *rewrites)
+{
+    uint8_t victim = LCD_CGRAM_SLOTS;
+    for (uint8_t slot = 0; slot < LCD_CGRAM_SLOTS; slot++) {
+        if (cgramSlots[slot].codepoint == codepoint) {
+            cgramSlots[slot].lastUsed = frameNum;
+            return slot;
+        }
+        if (cgramSlots[slot].lastUsed != frameNum &&
+            (victim == LCD_CGRAM_SLOTS || cgramSlots[slot].lastUsed < cgramSlots[victim].lastUsed))
+            victim = slot;
+    }
+    if (victim == LCD_CGRAM_SLOTS)
+        return victim;
+    // Cells still showing the evicted glyph differ from this frame and get rewritten
+    lcdWriteByte(LCD_SET_CGRAM_ADDR | (victim << 3), LCD_COMMAND);
+    for (uint8_t line = 0; line < sizeof(glyph->bitmap); line++) {
+        lcdWriteByte(glyph->bitmap[line], LCD_WRITE);
+    }
+    cgramSlots[victim].codepoint = codepoint;
+    cgramSlots[victim].lastUsed = frameNum;
+    (*rewrites)++;
+    return victim;
+}
+
+/// @brief Translate code points into display bytes and bring CGRAM up to date.
+/// Glyphs already cached are pinned first, so a slot is only reprogrammed when
+/// the visible screen needs a glyph that is not loaded yet.
+/// @return number of CGRAM slots rewritten for this frame
+static uint8_t lcdMapFrame(const uint16_t frame[LCD_ROWS][LCD_COLS], uint8_t cells[LCD_ROWS][LCD_COLS], uint32_t frameNum)
+{
+    uint8_t rewrites = 0;
+    for (uint8_t row = 0; row < LCD_ROWS; row++) {
+        for (uint8_t col = 0; col < LCD_COLS; col++) {
+            if (lcdCgramGlyph(frame[row][col]) == NULL)
+                continue;
+            for (uint8_t slot = 0; slot < LCD_CGRAM_SLOTS; slot++) {
+                if (cgramSlots[slot].codepoint == frame[row][col])
+                    cgramSlots[slot].lastUsed = frameNum;
+            }
+        }
+    }
+    for (uint8_t row = 0; row < LCD_ROWS; row++) {
+        for (uint8_t col = 0; col < LCD_COLS; col++) {
+            const lcdGlyph_t *glyph = lcdCgramGlyph(frame[row][col]);
+            if (glyph == NULL) {
+                cells[row][col] = lcdRomChar(frame[row][col]);
+                continue;
+            }
+            uint8_t slot = lcdCgramLoad(frame[row][col], glyph, frameNum, &rewrites);
+            cells[row][col] = slot == LCD_CGRAM_SLOTS ? glyph->fallback : slot;
+        }
+    }
+    return rewrites;
+}
+
+static void lcdBlankFrame(void)
+{
+    for (uint8_t row = 0; row < LCD_ROWS; row++) {
+        for (uint8_t col = 0; col < LCD_COLS; col++) {
+            lcdFrame[row][col] = ' ';
+        }
+    }
+}
+
+static void lcdPutChar(uint16_t codepoint)
+{
+    if (cursorRow < LCD_ROWS && cursorCol < LCD_COLS)
+        lcdFrame[cursorRow][cursorCol] = codepoint;
+    cursorCol++;
+}
+
+/// @brief Mark the frame dirty, the render task redraws it at most once per refresh period
+void lcdFlush(void)
+{
+    atomic_fetch_add(&renderRequests, 1);
+    if (xRenderTask != NULL)
+        xTaskNotifyGive(xRenderTask);
+}
+
+/// @brief Replace the whole screen with UTF-8 text. '\n' starts the next row,
+/// '\t' advances to the next 8-column cell, cells not covered are blanked.
+void lcdWriteFrame(const char *text)
+{
+    if(xSemaphoreTake( xMutex, MUTEX_TAKE_TICK_PERIOD ) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed write frame: display busy");
+        return;
+    }
+    layoutActive = false;
+    lcdBlankFrame();
+    uint8_t row = 0, col = 0;
+    while (*text) {
+        uint16_t codepoint = utf8Next(&text);
+        if (codepoint == '\n') {
+            row++;
+            col = 0;
+        } else if (codepoint == '\t') {
+            col = (col / TAB_SIZE + 1) * TAB_SIZE;
+        } else {
+            if (row < LCD_ROWS && col < LCD_COLS)
+                lcdFrame[row][col] = codepoint;
+            col++;
+        }
+    }
+    xSemaphoreGive(xMutex);
+    lcdFlush();
+}
+
+void lcdWriteRegion(uint8_t col, uint8_t row, const char *str)
+{
+    if (row > LCD_ROWS - 1) {
+        ESP_LOGE(TAG, "Cannot write to row %d. Please select a row in the range (0, %d)", row, LCD_ROWS - 1);
+        return;
+    }
+    if(xSemaphoreTake( xMutex, MUTEX_TAKE_TICK_PERIOD ) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed write region: display busy");
+        return;
+    }
+    for (; *str && col < LCD_COLS; col++) {
+        lcdFrame[row][col] = utf8Next(&str);
+    }
+    xSemaphoreGive(xMutex);
+    lcdFlush();
 }
 
 void lcdSetCursor(uint8_t col, uint8_t row)
@@ -49,67 +394,262 @@ void lcdSetCursor(uint8_t col, uint8_t row)
         ESP_LOGE(TAG, "Cannot write to row %d. Please select a row in the range (0, %d)", row, LCD_ROWS - 1);
         row = LCD_ROWS - 1;
     }
-    uint8_t row_offsets[] = {LCD_LINEONE, LCD_LINETWO, LCD_LINETHREE, LCD_LINEFOUR};
-    lcdWriteByte(LCD_SET_DDRAM_ADDR | (col + row_offsets[row]), LCD_COMMAND);
+    cursorCol = col;
+    cursorRow = row;
 }
 
 void lcdWriteChar(char c)
 {
-    lcdWriteByte(c, LCD_WRITE);                                        // Write data to DDRAM
+    if(xSemaphoreTake( xMutex, MUTEX_TAKE_TICK_PERIOD ) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed write: display busy");
+        return;
+    }
+    lcdPutChar((uint8_t)c);
+    xSemaphoreGive(xMutex);
+    lcdFlush();
 }
 
 void lcdWriteStr(const char* str)
 {
+    if(xSemaphoreTake( xMutex, MUTEX_TAKE_TICK_PERIOD ) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed write: display busy");
+        return;
+    }
     while (*str) {
-        lcdWriteChar(*str++);
+        lcdPutChar(utf8Next(&str));
     }
+    xSemaphoreGive(xMutex);
+    lcdFlush();
 }
 
 void lcdHome(void)
 {
-    lcdWriteByte(LCD_HOME, LCD_COMMAND);
-    ets_delay_us(2000);                                              // This command takes a while to complete
+    lcdSetCursor(0, 0);
 }
 
 void lcdClearScreen(void)
 {
-    lcdWriteByte(LCD_CLEAR, LCD_COMMAND);
-    ets_delay_us(2000);                                                // This command takes a while to complete
+    // Only the cells that are not blank yet are sent, no 2ms clear command
+    if(xSemaphoreTake( xMutex, MUTEX_TAKE_TICK_PERIOD ) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed clear: display busy");
+        return;
+    }
+    // Direct writes own the screen until the layout is shown again
+    layoutActive = false;
+    lcdBlankFrame();
+    xSemaphoreGive(xMutex);
+    lcdFlush();
+}
+
+/// @brief Draw the current page of the layout into lcdFrame, the caller holds the mutex.
+/// Cells keep their position on every page, so flipping only sends the changed characters.
+static void lcdLayoutDraw(void)
+{
+    lcdBlankFrame();
+    uint8_t first = layoutPage * LAYOUT_ITEMS_PER_PAGE;
+    for (uint8_t num = 0; num < LAYOUT_ITEMS_PER_PAGE && first + num < layoutCount; num++) {
+        uint16_t *cell = &lcdFrame[num / LAYOUT_CELLS_PER_ROW][(num % LAYOUT_CELLS_PER_ROW) * LAYOUT_CELL_WIDTH];
+        cell[0] = first + num == layoutHighlight ? '>' : ' ';
+        memcpy(&cell[1], layoutItems[first + num], sizeof(layoutItems[0]));
+    }
 }
 
+static uint8_t lcdLayoutPages(void)
+{
+    return (layoutCount + LAYOUT_ITEMS_PER_PAGE - 1) / LAYOUT_ITEMS_PER_PAGE;
+}
+
+/// @brief Drop the highlight and show the next page, if there is one
+static void lcdPageTimerCallback(void *arg)
+{
+    if(xSemaphoreTake( xMutex, MUTEX_TAKE_TICK_PERIOD ) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed page flip: display busy");
+        return;
+    }
+    if (!layoutActive || (lcdLayoutPages() < 2 && layoutHighlight == LAYOUT_NO_HIGHLIGHT)) {
+        xSemaphoreGive(xMutex);
+        return;
+    }
+    layoutHighlight = LAYOUT_NO_HIGHLIGHT;
+    if (lcdLayoutPages() > 1)
+        layoutPage = (layoutPage + 1) % lcdLayoutPages();
+    lcdLayoutDraw();
+    xSemaphoreGive(xMutex);
+    lcdFlush();
+}
+
+/// @brief Give the screen to the layout with the first count items
+void lcdLayoutShow(uint8_t count)
+{
+    if (count > LAYOUT_MAX_ITEMS) count = LAYOUT_MAX_ITEMS;
+    if(xSemaphoreTake( xMutex, MUTEX_TAKE_TICK_PERIOD ) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed show layout: display busy");
+        return;
+    }
+    layoutCount = count;
+    if (layoutPage >= lcdLayoutPages())
+        layoutPage = 0;
+    layoutActive = true;
+    lcdLayoutDraw();
+    xSemaphoreGive(xMutex);
+    lcdFlush();
+}
+
+/// @brief Set the UTF-8 text of a layout item, longer text is cut to the cell.
+/// A highlighted item is brought on screen and marked for one page period.
+void lcdLayoutSetItem(uint8_t index, const char *text, bool highlight)
+{
+    if (index >= LAYOUT_MAX_ITEMS) {
+        ESP_LOGE(TAG, "Cannot set layout item %d. Please select an item in the range (0, %d)", index, LAYOUT_MAX_ITEMS - 1);
+        return;
+    }
+    if(xSemaphoreTake( xMutex, MUTEX_TAKE_TICK_PERIOD ) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed set layout item: display busy");
+        return;
+    }
+    for (uint8_t col = 0; col < LAYOUT_ITEM_WIDTH; col++) {
+        layoutItems[index][col] = *text ? utf8Next(&text) : ' ';
+    }
+    if (highlight && index < layoutCount) {
+        layoutHighlight = index;
+        layoutPage = index / LAYOUT_ITEMS_PER_PAGE;
+        if (pageTimer != NULL)
+            esp_timer_restart(pageTimer, PAGE_PERIOD_US);
+    }
+    if (layoutActive)
+        lcdLayoutDraw();
+    xSemaphoreGive(xMutex);
+    if (layoutActive)
+        lcdFlush();
+}
+
+#if CONFIG_LCD_BENCHMARK
+// Previous transfer scheme: three transactions per nibble and a 500us wait
+static void lcdLegacyWriteNibble(uint8_t nibble, uint8_t mode)
+{
+    uint8_t data = (nibble & 0xF0) | mode | LCD_BACKLIGHT;
+    i2c_master_transmit(i2cDevice, &data, 1, -1);
+    uint8_t buf = data | LCD_ENABLE;
+    i2c_master_transmit(i2cDevice, &buf, 1, -1);
+    ets_delay_us(1);
+    buf = data & ~LCD_ENABLE;
+    i2c_master_transmit(i2cDevice, &buf, 1, -1);
+    ets_delay_us(500);
+}
+
+/// @brief Log characters per second of the previous and the burst transfer,
+/// the blank first row is rewritten so the screen does not change.
+static void lcdBenchmark(void)
+{
+    int64_t start = esp_timer_get_time();
+    lcdLegacyWriteNibble(LCD_SET_DDRAM_ADDR | LCD_LINEONE, LCD_COMMAND);
+    lcdLegacyWriteNibble((uint8_t)((LCD_SET_DDRAM_ADDR | LCD_LINEONE) << 4), LCD_COMMAND);
+    for (uint8_t col = 0; col < LCD_COLS; col++) {
+        lcdLegacyWriteNibble(' ', LCD_WRITE);
+        lcdLegacyWriteNibble((uint8_t)(' ' << 4), LCD_WRITE);
+    }
+    int64_t legacyTime = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    lcdWriteByte(LCD_SET_DDRAM_ADDR | LCD_LINEONE, LCD_COMMAND);
+    for (uint8_t col = 0; col < LCD_COLS; col++) {
+        lcdWriteByte(' ', LCD_WRITE);
+    }
+    lcdBurstSend();
+    int64_t burstTime = esp_timer_get_time() - start;
+
+    ESP_LOGI(TAG, "benchmark %d chars: per-byte %lld chars/s, burst %lld chars/s",
+        LCD_COLS, 1000000LL * LCD_COLS / legacyTime, 1000000LL * LCD_COLS / burstTime);
+}
+#endif
+
+/// @brief One step of the HD44780 bring-up, called from the render task.
+/// Each step sends one short burst and returns the wait the controller needs.
+/// @return us to wait before the next step, 0 when the controller is ready
+static int64_t lcdInitStep(lcdInitState_t state)
+{
+    switch (state) {
+    case LCD_INIT_POWER_UP:
+        lcdWriteNibble(LCD_BACKLIGHT, LCD_COMMAND);
+        return 1000000;
+    case LCD_INIT_RESET_1:
+        lcdWriteNibble(LCD_FUNCTION_RESET, LCD_COMMAND);                   // First part of reset sequence
+        return 4500;                                                       // min 4.1 mS delay (min)
+    case LCD_INIT_RESET_2:
+        lcdWriteNibble(LCD_FUNCTION_RESET, LCD_COMMAND);                   // second part of reset sequence
+        return 4500;                                                       // min 4.1 mS delay (min)
+    case LCD_INIT_RESET_3:
+        lcdWriteNibble(LCD_FUNCTION_RESET, LCD_COMMAND);                   // third part of reset sequence
+        return 150;
+    case LCD_INIT_4BIT:
+        lcdWriteNibble(LCD_FUNCTION_SET_4BIT, LCD_COMMAND);                // Activate 4-bit mode
+        return 80;                                                         // 40 uS delay (min)
+    case LCD_INIT_CLEAR:
+        // --- Busy flag now available ---
+        lcdWriteByte(LCD_FUNCTION_SET_4BIT, LCD_COMMAND);                  // Set mode, lines, and font
+        lcdWriteByte(LCD_DISPLAY_ON, LCD_COMMAND);
+        lcdWriteByte(LCD_CLEAR, LCD_COMMAND);                              // clear display RAM
+        lcdBurstSend();
+        return 2000;                                                       // Clearing memory takes a bit longer
+    case LCD_INIT_ENTRY_MODE:
+        lcdWriteByte(LCD_ENTRY_MODE, LCD_COMMAND);                         // Set desired shift characteristics
+        lcdBurstSend();
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+/// @brief Bring the controller up from the render task. The waits sleep the task,
+/// rounded up to whole ticks, so the rest of the system runs meanwhile.
 static void lcdInit(void)
 {
-    vTaskDelay(50 / portTICK_PERIOD_MS);                                 // Initial 50 mSec delay
-    lcdWriteNibble(LCD_BACKLIGHT, LCD_COMMAND); 
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
-    // Reset the LCD controller
-    lcdWriteNibble(LCD_FUNCTION_RESET, LCD_COMMAND);                   // First part of reset sequence
-    ets_delay_us(4500);                                                  // min 4.1 mS delay (min)
-    lcdWriteNibble(LCD_FUNCTION_RESET, LCD_COMMAND);                   // second part of reset sequence
-    ets_delay_us(4500);                              // min 4.1 mS delay (min)
-    lcdWriteNibble(LCD_FUNCTION_RESET, LCD_COMMAND);                   // third part of reset sequence
-    ets_delay_us(150);
-    lcdWriteNibble(LCD_FUNCTION_SET_4BIT, LCD_COMMAND);                // Activate 4-bit mode
-    ets_delay_us(80);                                                  // 40 uS delay (min)
-    // --- Busy flag now available ---
-    // Function Set instruction
-    lcdWriteByte(LCD_FUNCTION_SET_4BIT, LCD_COMMAND);                  // Set mode, lines, and font
-    ets_delay_us(80);
-
-    lcdWriteByte(LCD_DISPLAY_ON, LCD_COMMAND);
-
-    // Clear Display instruction
-    lcdWriteByte(LCD_CLEAR, LCD_COMMAND);                              // clear display RAM
-    ets_delay_us(1000);                                                // Clearing memory takes a bit longer
-    
-    // Entry Mode Set instruction
-    lcdWriteByte(LCD_ENTRY_MODE, LCD_COMMAND);                         // Set desired shift characteristics
-    ets_delay_us(80);
-    
+    const int64_t tickUs = portTICK_PERIOD_MS * 1000;
+    vTaskDelay(pdMS_TO_TICKS(50) + 1);                                     // 50 ms after power-up
+    for (lcdInitState_t state = LCD_INIT_POWER_UP; state < LCD_INIT_DONE; state++) {
+        int64_t waitUs = lcdInitStep(state);
+        if (waitUs > 0)
+            vTaskDelay((waitUs + tickUs - 1) / tickUs);
+    }
+#if CONFIG_LCD_BENCHMARK
+    lcdBenchmark();
+#endif
+    ESP_LOGI(TAG, "LCD ready after %lld ms", (esp_timer_get_time() - initStartTime) / 1000);
+}
+
+/// @brief Owns the display: brings the controller up, then takes a snapshot of the
+/// latest frame and sends the changed cells, so producers never wait for the I2C bus.
+static void lcdRenderTask(void *pvParameters)
+{
+    uint16_t frame[LCD_ROWS][LCD_COLS];
+    uint8_t cells[LCD_ROWS][LCD_COLS];
+    lcdInit();
+    // Draw everything written while the controller was starting
+    lcdFlush();
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        xSemaphoreTake(xMutex, portMAX_DELAY);
+        memcpy(frame, lcdFrame, sizeof(frame));
+        xSemaphoreGive(xMutex);
+        renderFrames++;
+        uint8_t rewrites = lcdMapFrame(frame, cells, renderFrames);
+        cgramWrites += rewrites;
+        lcdFlushFrame(cells);
+        ESP_LOGD(TAG, "frame rendered: %lu frames for %lu requests, %u CGRAM rewrites (%lu total)",
+            renderFrames, (uint32_t)atomic_load(&renderRequests), rewrites, cgramWrites);
+        // Requests arriving meanwhile are collapsed into one redraw
+        vTaskDelay(REFRESH_TICK_PERIOD);
+    }
 }
 
 void matrixLcdInit(void)
 {
+    static StaticSemaphore_t xSemaphoreBuffer;
+    xMutex = xSemaphoreCreateMutexStatic(&xSemaphoreBuffer);
+    // The controller is cleared by the init sequence
+    lcdBlankFrame();
+    memset(lcdShadow, ' ', sizeof(lcdShadow));
+
     i2c_master_bus_config_t i2cBusConfig = {
         .i2c_port = I2C_PORT,
         .sda_io_num = PIN_NUM_SDA,
@@ -143,7 +683,23 @@ void matrixLcdInit(void)
         return;
     };
 
-    lcdInit();
-    lcdHome();
-    ESP_LOGI(TAG, "matrix_lcd init finished.");
+    // The render task brings the controller up, the rest of the boot does not wait for it
+    initStartTime = esp_timer_get_time();
+    static StaticTask_t xTaskBuffer;
+    static StackType_t xStack[STACK_SIZE];
+    xRenderTask = xTaskCreateStatic(lcdRenderTask, "lcdRenderTask", STACK_SIZE, NULL, 2, xStack, &xTaskBuffer);
+    if (xRenderTask == NULL){
+        ESP_LOGE(TAG, "Task \"lcdRenderTask\" not created");
+    }
+    const esp_timer_create_args_t pageTimerArgs = {
+        .callback = &lcdPageTimerCallback,
+        .name = "lcdPage"
+    };
+    err = esp_timer_create(&pageTimerArgs, &pageTimer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed create page timer, err: %d (%s)", err, esp_err_to_name(err));
+    } else {
+        esp_timer_start_periodic(pageTimer, PAGE_PERIOD_US);
+    }
+    ESP_LOGI(TAG, "matrix_lcd init started.");
 }
\ No newline at end of file
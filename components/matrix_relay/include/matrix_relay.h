@@ -2,11 +2,52 @@
 #ifndef __MATRIX_RELAY_H__
 #define __MATRIX_RELAY_H__
 
+#include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/// @brief Called from the SPI ISR when the last word of an async frame is latched, must be IRAM safe
+typedef void (*relayLatchCallback_t)(int64_t latchTime, void *arg);
+
+typedef struct {
+    uint32_t latched; // async frames latched
+    int64_t lastLatency; // us from queueing to latch
+    int64_t maxLatency;
+} relayStats_t;
+
+#define RELAY_TRACE_WORDS 4
+
+typedef enum {
+    RELAY_TRACE_SYNC = 0,
+    RELAY_TRACE_POLLING,
+    RELAY_TRACE_ASYNC
+} relayTracePath_t;
+
+typedef struct {
+    uint32_t seq; // 1 for the first record since boot
+    int64_t time; // us since boot
+    uint8_t path; // relayTracePath_t
+    uint8_t sz; // words in the chain, the first RELAY_TRACE_WORDS are kept
+    uint16_t words[RELAY_TRACE_WORDS];
+    TaskHandle_t task; // calling task
+} relayTraceRecord_t;
+
 void sendToRelay(uint16_t *buf, uint8_t sz);
+void sendToRelayPolling(uint16_t *buf, uint8_t sz);
+esp_err_t sendToRelayAsync(uint16_t *buf, uint8_t sz, relayLatchCallback_t callback, void *callbackArg);
+void getRelayStats(relayStats_t *stats);
+size_t getRelayTrace(relayTraceRecord_t *records, size_t maxRecords);
+const char * getJsonRelayTrace();
+BaseType_t saveRelayWear();
+const char * getJsonRelayWear();
+void matrixRelayWearInit(void);
+void matrixRelayBenchmark(uint16_t *buf, uint8_t sz, uint16_t iterations);
 void matrixRelayInit(void);
 
 #ifdef __cplusplus
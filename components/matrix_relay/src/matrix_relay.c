@@ -1,18 +1,79 @@
 #include <string.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "driver/spi_master.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
 #include "esp_log.h"
+#include "cJSON.h"
+#include "nvs_preferences.h"
 #include "matrix_relay.h"
 
 #define PIN_NUM_MOSI CONFIG_PIN_NUM_MOSI
 #define PIN_NUM_CLK CONFIG_PIN_NUM_CLK
 #define PIN_NUM_CS CONFIG_PIN_NUM_CS
 #define SPI_HOST SPI2_HOST
+#define QUEUE_SIZE CONFIG_RELAY_QUEUE_SIZE
+#define CHAIN_MAX CONFIG_RELAY_CHAIN_MAX
+#define TRACE_SIZE CONFIG_RELAY_TRACE_SIZE
+#define RELAYS_MAX (CHAIN_MAX * 16)
+#define RATED_OPERATIONS CONFIG_RELAY_RATED_OPERATIONS
+#define WEAR_SAVE_TICK_PERIOD pdMS_TO_TICKS(CONFIG_RELAY_WEAR_SAVE_PERIOD * 60 * 1000)
+#define OPERATING_TIME_SAVE_PERIOD (CONFIG_RELAY_OPERATING_TIME_SAVE_PERIOD * 60 * 1000000LL)
+#define WEAR_STACK_SIZE 3072
+#define IDLE_WORD 0xFFFF // all relays released
+#define NVSGROUP "relay"
+#define MUTEX_TAKE_TICK_PERIOD 1000 / portTICK_PERIOD_MS
 
 #define CLOCK_SPEED_HZ (10000000) // 10 MHz
 
 static const char *TAG = "matrix_relay";
 
+// Queued transaction slot, the frame is copied so the caller buffer may go out of scope
+typedef struct {
+    spi_transaction_t tr;
+    relayLatchCallback_t callback;
+    void *callbackArg;
+    int64_t queuedTime;
+    WORD_ALIGNED_ATTR uint16_t words[CHAIN_MAX];
+} relayTrans_t;
+
 static spi_device_handle_t spiDevice;
+static SemaphoreHandle_t xMutex;
+DMA_ATTR static relayTrans_t relayTrans[QUEUE_SIZE];
+DMA_ATTR static relayTrans_t syncTrans;
+static uint8_t transHead = 0;
+static uint8_t transPending = 0;
+static relayStats_t relayStats;       // written by the SPI ISR, under statsLock
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+static relayTraceRecord_t relayTrace[TRACE_SIZE]; // under xMutex
+static uint32_t traceNext = 0;
+static TaskHandle_t initTask = NULL;    // app_main, deleted after boot, named once at init
+static char initTaskName[configMAX_TASK_NAME_LEN] = "";
+
+static const char *tracePathName[] = {"sync", "polling", "async"};
+
+// Relay wear, persisted as one blob. The header tells how many counters follow,
+// so a blob saved with another RELAY_CHAIN_MAX still loads.
+#define WEAR_VERSION 1
+typedef struct {
+    uint16_t version;
+    uint16_t relays;        // counters stored
+    uint32_t operatingTime; // s
+    uint32_t actuations[RELAYS_MAX];
+} relayWear_t;
+#define WEAR_HEADER_SIZE offsetof(relayWear_t, actuations)
+
+static relayWear_t relayWear;
+static uint16_t lastWords[CHAIN_MAX];
+static uint8_t lastSz = 0;
+static uint32_t wearChanges = 0;       // counted actuations, under xMutex
+static uint32_t wearSavedChanges = 0;  // wearChanges of the last successful save, under xMutex
+static int64_t wearSavedTime = 0;      // operating time counted up to here, under xMutex
+static int64_t wearPersistedTime = 0;  // last successful save, under xMutex
+static nvs_handle_t pHandle = 0;
 
 static bool uint16ToBinaryStr(char *buf, uint16_t n) {
     for (uint16_t mask = 0x8000;  mask;  mask >>= 1) {
@@ -24,34 +85,417 @@ static bool uint16ToBinaryStr(char *buf, uint16_t n) {
     return true;
 }
 
-void sendToRelay(uint16_t *buf, uint8_t sz)
+/// @brief Append a binary record to the trace ring, called with xMutex held.
+/// Only the task handle is kept, getJsonRelayTrace() resolves the name.
+static void traceRecord(relayTracePath_t path, const uint16_t *buf, uint8_t sz)
 {
-    spi_transaction_t tr;
-    memset(&tr, 0, sizeof(tr));
+    relayTraceRecord_t *rec = &(relayTrace[traceNext % TRACE_SIZE]);
+    rec->seq = ++traceNext;
+    rec->time = esp_timer_get_time();
+    rec->path = path;
+    rec->sz = sz;
+    memcpy(rec->words, buf, (sz < RELAY_TRACE_WORDS ? sz : RELAY_TRACE_WORDS) * sizeof(*buf));
+    rec->task = xTaskGetCurrentTaskHandle();
+}
+
+/// @brief Count relays toggled by the new frame: XOR with the previous frame and
+/// walk the set bits. The first frame after boot only sets the reference.
+static void countActuations(const uint16_t *buf, uint8_t sz)
+{
+    uint8_t common = sz < lastSz ? sz : lastSz;
+    for (uint8_t i = 0; i < common; i++) {
+        uint16_t toggled = buf[i] ^ lastWords[i];
+        while (toggled) {
+            relayWear.actuations[i * 16 + __builtin_ctz(toggled)]++;
+            toggled &= toggled - 1;
+            wearChanges++;
+        }
+    }
+    memcpy(lastWords, buf, sz * sizeof(*buf));
+    lastSz = sz;
+}
+
+static void IRAM_ATTR relayPostCallback(spi_transaction_t *tr)
+{
+    relayTrans_t *rtrans = (relayTrans_t *)tr->user;
+    if (rtrans == NULL || rtrans == &syncTrans)
+        return;
+    int64_t latchTime = esp_timer_get_time();
+    int64_t latency = latchTime - rtrans->queuedTime;
+    taskENTER_CRITICAL_ISR(&statsLock);
+    relayStats.lastLatency = latency;
+    if (latency > relayStats.maxLatency) relayStats.maxLatency = latency;
+    relayStats.latched++;
+    taskEXIT_CRITICAL_ISR(&statsLock);
+    if (rtrans->callback)
+        rtrans->callback(latchTime, rtrans->callbackArg);
+}
+
+static void reapTransactions(TickType_t ticksToWait)
+{
+    spi_transaction_t *tr;
+    while (transPending > 0) {
+        if (spi_device_get_trans_result(spiDevice, &tr, ticksToWait) != ESP_OK)
+            break;
+        transPending--;
+    }
+}
+
+/// @brief Build one CS-framed transaction for the whole chain.
+/// buf[0] is the register nearest to the MCU, so it is shifted out last.
+static void fillTransaction(relayTrans_t *rtrans, const uint16_t *buf, uint8_t sz)
+{
+    spi_transaction_t *tr = &(rtrans->tr);
+    memset(tr, 0, sizeof(*tr));
+    tr->length = 16 * sz;
+    tr->user = rtrans;
+    if (sz == 1) {
+        // A single register fits the SPI FIFO, no DMA descriptor needed
+        tr->flags = SPI_TRANS_USE_TXDATA;
+        memcpy(tr->tx_data, buf, sizeof(*buf));
+        return;
+    }
     for (uint8_t i = 0; i < sz; i++) {
-        tr.length = 16;
-        tr.tx_buffer = buf + i;
-        char bin[17] = ""; 
-        uint16ToBinaryStr(bin, buf[0]);
-        ESP_LOGI(TAG, "transmit code: %s", bin);
-        spi_device_transmit(spiDevice, &tr);
+        rtrans->words[i] = buf[sz - 1 - i];
+    }
+    tr->tx_buffer = rtrans->words;
+}
+
+void sendToRelay(uint16_t *buf, uint8_t sz)
+{
+    if (sz == 0 || sz > CHAIN_MAX) {
+        ESP_LOGE(TAG, "Invalid chain length: %d", sz);
+        return;
+    }
+    if(xSemaphoreTake( xMutex, MUTEX_TAKE_TICK_PERIOD ) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed transmit: relay bus busy");
+        return;
+    }
+    reapTransactions(portMAX_DELAY);
+    fillTransaction(&syncTrans, buf, sz);
+    traceRecord(RELAY_TRACE_SYNC, buf, sz);
+    countActuations(buf, sz);
+    spi_device_transmit(spiDevice, &(syncTrans.tr));
+    xSemaphoreGive(xMutex);
+    ESP_LOGD(TAG, "transmitted %d words, first word 0x%04x", sz, buf[0]);
+}
+
+void sendToRelayPolling(uint16_t *buf, uint8_t sz)
+{
+    if (sz == 0 || sz > CHAIN_MAX) {
+        ESP_LOGE(TAG, "Invalid chain length: %d", sz);
+        return;
+    }
+    if(xSemaphoreTake( xMutex, MUTEX_TAKE_TICK_PERIOD ) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed transmit: relay bus busy");
+        return;
+    }
+    // Polling and interrupt transactions cannot be mixed on one device
+    reapTransactions(portMAX_DELAY);
+    fillTransaction(&syncTrans, buf, sz);
+    traceRecord(RELAY_TRACE_POLLING, buf, sz);
+    countActuations(buf, sz);
+    spi_device_polling_transmit(spiDevice, &(syncTrans.tr));
+    xSemaphoreGive(xMutex);
+    ESP_LOGD(TAG, "transmitted %d words, first word 0x%04x", sz, buf[0]);
+}
+
+esp_err_t sendToRelayAsync(uint16_t *buf, uint8_t sz, relayLatchCallback_t callback, void *callbackArg)
+{
+    if (sz == 0 || sz > CHAIN_MAX)
+        return ESP_ERR_INVALID_SIZE;
+    if(xSemaphoreTake( xMutex, MUTEX_TAKE_TICK_PERIOD ) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed transmit: relay bus busy");
+        return ESP_ERR_TIMEOUT;
+    }
+    // Free completed slots without waiting, block only if the queue is full
+    reapTransactions(0);
+    if (transPending == QUEUE_SIZE) {
+        spi_transaction_t *tr;
+        if (spi_device_get_trans_result(spiDevice, &tr, portMAX_DELAY) == ESP_OK)
+            transPending--;
+    }
+    relayTrans_t *rtrans = &(relayTrans[transHead]);
+    fillTransaction(rtrans, buf, sz);
+    rtrans->callback = callback;
+    rtrans->callbackArg = callbackArg;
+    rtrans->queuedTime = esp_timer_get_time();
+    traceRecord(RELAY_TRACE_ASYNC, buf, sz);
+    countActuations(buf, sz);
+    esp_err_t err = spi_device_queue_trans(spiDevice, &(rtrans->tr), 0);
+    if (err == ESP_OK) {
+        transHead = (transHead + 1) % QUEUE_SIZE;
+        transPending++;
+    }
+    else {
+        ESP_LOGE(TAG, "Failed queue transaction, err: %d (%s)", err, esp_err_to_name(err));
+    }
+    xSemaphoreGive(xMutex);
+    ESP_LOGD(TAG, "queued %d words, first word 0x%04x", sz, buf[0]);
+    return err;
+}
+
+void getRelayStats(relayStats_t *stats)
+{
+    // The 64-bit latencies are two words on this core, copy them whole
+    taskENTER_CRITICAL(&statsLock);
+    *stats = relayStats;
+    taskEXIT_CRITICAL(&statsLock);
+}
+
+size_t getRelayTrace(relayTraceRecord_t *records, size_t maxRecords)
+{
+    if(xSemaphoreTake( xMutex, MUTEX_TAKE_TICK_PERIOD ) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed read relay trace: relay bus busy");
+        return 0;
+    }
+    uint32_t first = traceNext > TRACE_SIZE ? traceNext - TRACE_SIZE : 0;
+    if (traceNext - first > maxRecords) first = traceNext - maxRecords;
+    size_t count = 0;
+    for (uint32_t n = first; n < traceNext; n++) {
+        records[count++] = relayTrace[n % TRACE_SIZE];
+    }
+    xSemaphoreGive(xMutex);
+    return count;
+}
+
+const char * getJsonRelayTrace()
+{
+    relayTraceRecord_t *records = malloc(TRACE_SIZE * sizeof(relayTraceRecord_t));
+    if (records == NULL)
+        return NULL;
+    size_t count = getRelayTrace(records, TRACE_SIZE);
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON *json_records = cJSON_AddArrayToObject(root, "records");
+    for (size_t r = 0; r < count; r++) {
+        relayTraceRecord_t *rec = &(records[r]);
+        cJSON *json_record, *json_words;
+        cJSON_AddItemToArray(json_records, json_record = cJSON_CreateObject());
+        cJSON_AddNumberToObject(json_record, "seq", rec->seq);
+        cJSON_AddNumberToObject(json_record, "time", rec->time);
+        cJSON_AddStringToObject(json_record, "path", tracePathName[rec->path]);
+        cJSON_AddStringToObject(json_record, "task", rec->task == initTask ? initTaskName : pcTaskGetName(rec->task));
+        cJSON_AddNumberToObject(json_record, "size", rec->sz);
+        json_words = cJSON_AddArrayToObject(json_record, "words");
+        for (uint8_t i = 0; i < rec->sz && i < RELAY_TRACE_WORDS; i++) {
+            char bin[17] = "";
+            uint16ToBinaryStr(bin, rec->words[i]);
+            cJSON_AddItemToArray(json_words, cJSON_CreateString(bin));
+        }
+    }
+    cJSON_AddNumberToObject(root, "count", count);
+    free(records);
+
+    char *json = cJSON_Print(root);
+    cJSON_Delete(root);
+    return json;
+}
+
+BaseType_t saveRelayWear()
+{
+    relayWear_t *wear = malloc(sizeof(relayWear_t));
+    if (wear == NULL)
+        return pdFALSE;
+    if(xSemaphoreTake( xMutex, MUTEX_TAKE_TICK_PERIOD ) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed save relay wear: relay bus busy");
+        free(wear);
+        return pdFALSE;
+    }
+    int64_t now = esp_timer_get_time();
+    // Whole seconds only, the remainder counts towards the next save
+    uint32_t seconds = (now - wearSavedTime) / 1000000;
+    relayWear.operatingTime += seconds;
+    wearSavedTime += seconds * 1000000LL;
+    *wear = relayWear;
+    uint32_t changes = wearChanges;
+    xSemaphoreGive(xMutex);
+    wear->version = WEAR_VERSION;
+    wear->relays = RELAYS_MAX;
+
+    // NVS write outside the bus mutex, latching is never delayed by flash
+    BaseType_t result = pdFALSE;
+    if(nvsOpen(NVSGROUP, NVS_READWRITE, &pHandle) == pdTRUE) {
+        result = setBlobPref(pHandle, "wear", wear, sizeof(relayWear_t));
+        nvs_close(pHandle);
+    }
+    free(wear);
+    if (result != pdTRUE) {
+        // Still dirty, the next period retries
+        ESP_LOGW(TAG, "Failed save relay wear");
+        return pdFALSE;
+    }
+    xSemaphoreTake(xMutex, portMAX_DELAY);
+    wearSavedChanges = changes;
+    wearPersistedTime = now;
+    xSemaphoreGive(xMutex);
+    ESP_LOGI(TAG, "Relay wear saved");
+    return pdTRUE;
+}
+
+/// @brief Batched wear saves. An NVS commit erases and writes flash, so it runs in
+/// a task of its own rather than the esp_timer task. Actuations are saved at the
+/// wear period, the operating time alone at its own longer period.
+static void wearSaveTask(void *pvParameters)
+{
+    while (1) {
+        vTaskDelay(WEAR_SAVE_TICK_PERIOD);
+        xSemaphoreTake(xMutex, portMAX_DELAY);
+        bool due = wearChanges != wearSavedChanges
+            || esp_timer_get_time() - wearPersistedTime >= OPERATING_TIME_SAVE_PERIOD;
+        xSemaphoreGive(xMutex);
+        if (due) saveRelayWear();
+    }
+}
+
+const char * getJsonRelayWear()
+{
+    relayWear_t *wear = malloc(sizeof(relayWear_t));
+    if (wear == NULL)
+        return NULL;
+    xSemaphoreTake(xMutex, portMAX_DELAY);
+    *wear = relayWear;
+    uint8_t sz = lastSz;
+    int64_t operatingTime = wear->operatingTime + (esp_timer_get_time() - wearSavedTime) / 1000000;
+    xSemaphoreGive(xMutex);
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON *json_relays, *json_relay;
+    cJSON_AddNumberToObject(root, "rated_operations", RATED_OPERATIONS);
+    cJSON_AddNumberToObject(root, "operating_time", operatingTime);
+    json_relays = cJSON_AddArrayToObject(root, "relays");
+    for (uint16_t r = 0; r < sz * 16; r++) {
+        uint32_t actuations = wear->actuations[r];
+        cJSON_AddItemToArray(json_relays, json_relay = cJSON_CreateObject());
+        cJSON_AddNumberToObject(json_relay, "id", r);
+        cJSON_AddNumberToObject(json_relay, "actuations", actuations);
+        int64_t remaining = actuations < RATED_OPERATIONS ? RATED_OPERATIONS - actuations : 0;
+        cJSON_AddNumberToObject(json_relay, "remaining", remaining);
+        // projected remaining life at the average rate seen so far, -1 if unknown
+        double remainingDays = -1;
+        if (actuations > 0 && operatingTime > 0)
+            remainingDays = (double)remaining * operatingTime / actuations / 86400;
+        cJSON_AddNumberToObject(json_relay, "remaining_days", remainingDays);
+    }
+    free(wear);
+
+    char *json = cJSON_Print(root);
+    cJSON_Delete(root);
+    return json;
+}
+
+/// @brief Load the persisted wear counters and start the batched save task.
+/// Called once NVS is available, counts taken before that are kept.
+void matrixRelayWearInit(void)
+{
+    size_t size = 0;
+    if(nvsOpen(NVSGROUP, NVS_READONLY, &pHandle) != pdTRUE) {
+        ESP_LOGW(TAG, "Namespace '%s' notfound", NVSGROUP);
+    }
+    else {
+        relayWear_t *wear = NULL;
+        if (getBlobSizePref(pHandle, "wear", &size) == pdTRUE && size >= WEAR_HEADER_SIZE)
+            wear = malloc(size);
+        if (wear != NULL && getBlobPref(pHandle, "wear", wear, size) == pdTRUE) {
+            if (wear->version != WEAR_VERSION || size != WEAR_HEADER_SIZE + wear->relays * sizeof(uint32_t)) {
+                ESP_LOGW(TAG, "Relay wear of unknown format (%d bytes) ignored", size);
+            }
+            else {
+                uint16_t relays = wear->relays < RELAYS_MAX ? wear->relays : RELAYS_MAX;
+                if (relays < wear->relays)
+                    ESP_LOGW(TAG, "Relay wear of %d relays beyond the chain dropped", wear->relays - relays);
+                xSemaphoreTake(xMutex, portMAX_DELAY);
+                relayWear.operatingTime += wear->operatingTime;
+                for (uint16_t r = 0; r < relays; r++) {
+                    relayWear.actuations[r] += wear->actuations[r];
+                }
+                xSemaphoreGive(xMutex);
+            }
+        }
+        free(wear);
+        nvs_close(pHandle);
+    }
+
+    wearPersistedTime = esp_timer_get_time();
+    static StaticTask_t xTaskBuffer;
+    static StackType_t xStack[WEAR_STACK_SIZE];
+    xTaskCreateStatic(wearSaveTask, "relayWearSave", WEAR_STACK_SIZE, NULL, 1, xStack, &xTaskBuffer);
+    ESP_LOGI(TAG, "Relay wear loaded");
+}
+
+/// @brief Time interrupt and polling latches for 1, 4 and 16 chained registers.
+/// buf holds the whole physical chain. A longer frame pads with idle words that
+/// shift out past the last register, so every latch leaves the chain at buf and no
+/// relay toggles. A frame shorter than the chain would move the routing along the
+/// registers, those lengths are skipped.
+void matrixRelayBenchmark(uint16_t *buf, uint8_t sz, uint16_t iterations)
+{
+    static const uint8_t chainLengths[] = {1, 4, 16};
+    uint16_t words[CHAIN_MAX];
+
+    if (iterations == 0 || sz == 0 || sz > CHAIN_MAX)
+        return;
+    if(xSemaphoreTake( xMutex, MUTEX_TAKE_TICK_PERIOD ) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed benchmark: relay bus busy");
+        return;
     }
+    reapTransactions(portMAX_DELAY);
+
+    for (uint8_t c = 0; c < sizeof(chainLengths); c++) {
+        uint8_t len = chainLengths[c];
+        if (len > CHAIN_MAX) break;
+        if (len < sz) {
+            ESP_LOGI(TAG, "benchmark %2d registers: skipped, the chain has %d", len, sz);
+            continue;
+        }
+        for (uint8_t i = 0; i < len; i++) {
+            words[i] = i < sz ? buf[i] : IDLE_WORD;
+        }
+        fillTransaction(&syncTrans, words, len);
+
+        int64_t start = esp_timer_get_time();
+        for (uint16_t n = 0; n < iterations; n++) {
+            spi_device_transmit(spiDevice, &(syncTrans.tr));
+        }
+        int64_t interruptTime = esp_timer_get_time() - start;
+
+        start = esp_timer_get_time();
+        for (uint16_t n = 0; n < iterations; n++) {
+            spi_device_polling_transmit(spiDevice, &(syncTrans.tr));
+        }
+        int64_t pollingTime = esp_timer_get_time() - start;
+
+        ESP_LOGI(TAG, "benchmark %2d registers: interrupt %lld us/latch (%lld kbit/s), polling %lld us/latch (%lld kbit/s)",
+            len, interruptTime / iterations, 16000LL * len * iterations / interruptTime,
+            pollingTime / iterations, 16000LL * len * iterations / pollingTime);
+    }
+    fillTransaction(&syncTrans, buf, sz);
+    traceRecord(RELAY_TRACE_POLLING, buf, sz);
+    countActuations(buf, sz);
+    spi_device_polling_transmit(spiDevice, &(syncTrans.tr));
+    xSemaphoreGive(xMutex);
+    ESP_LOGD(TAG, "transmitted %d words, first word 0x%04x", sz, buf[0]);
 }
 
 void matrixRelayInit(void)
 {      
+    static StaticSemaphore_t xSemaphoreBuffer;
+    xMutex = xSemaphoreCreateMutexStatic(&xSemaphoreBuffer);
+    initTask = xTaskGetCurrentTaskHandle();
+    strlcpy(initTaskName, pcTaskGetName(initTask), sizeof(initTaskName));
+
     spi_bus_config_t spiBusConfig = {
         .mosi_io_num = PIN_NUM_MOSI,
         .miso_io_num = -1,
         .sclk_io_num = PIN_NUM_CLK,
         .quadwp_io_num = -1,
         .quadhd_io_num = -1,
-        .max_transfer_sz = 2,
+        .max_transfer_sz = CHAIN_MAX * sizeof(uint16_t),
         .data_io_default_level = false,
         .flags = 0
     };
     
-    esp_err_t err = spi_bus_initialize(SPI_HOST, &spiBusConfig, SPI_DMA_DISABLED);
+    esp_err_t err = spi_bus_initialize(SPI_HOST, &spiBusConfig, SPI_DMA_CH_AUTO);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed initilize spi bus, err: %d (%s)", err, esp_err_to_name(err));
         return;
@@ -62,8 +506,9 @@ void matrixRelayInit(void)
     spiIfConfig.spics_io_num = PIN_NUM_CS;
     spiIfConfig.clock_speed_hz = CLOCK_SPEED_HZ;
     spiIfConfig.mode = 0;
-    spiIfConfig.queue_size = 1;
+    spiIfConfig.queue_size = QUEUE_SIZE;
     spiIfConfig.flags = SPI_DEVICE_NO_DUMMY;
+    spiIfConfig.post_cb = relayPostCallback;
     
     err = spi_bus_add_device(SPI_HOST, &spiIfConfig, &spiDevice);
     if (err != ESP_OK) {
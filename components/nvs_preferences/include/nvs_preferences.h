@@ -17,6 +17,9 @@ BaseType_t getUInt16Pref(nvs_handle_t pHandle, const char *key, uint16_t *value)
 BaseType_t setUInt16Pref(nvs_handle_t pHandle, const char *key, uint16_t value);
 BaseType_t getUInt32Pref(nvs_handle_t pHandle, const char *key, uint32_t *value);
 BaseType_t setUInt32Pref(nvs_handle_t pHandle, const char *key, uint32_t value);
+BaseType_t getBlobSizePref(nvs_handle_t pHandle, const char *key, size_t *valueSize);
+BaseType_t getBlobPref(nvs_handle_t pHandle, const char *key, void *value, size_t valueSize);
+BaseType_t setBlobPref(nvs_handle_t pHandle, const char *key, const void *value, size_t valueSize);
 #ifdef __cplusplus
 }
 #endif
@@ -116,4 +116,38 @@ BaseType_t setUInt32Pref(nvs_handle_t pHandle, const char *key, uint32_t value)
         ESP_LOGE(TAG, "Failed to set preferences \"%s\": %d (%s)", key, err, esp_err_to_name(err));
         return pdFALSE;
     }
+}
+
+BaseType_t getBlobSizePref(nvs_handle_t pHandle, const char *key, size_t *valueSize)
+{
+    esp_err_t err = nvs_get_blob(pHandle, key, NULL, valueSize);
+    if(err == ESP_OK)
+        return pdTRUE;
+    else {
+        ESP_LOGE(TAG, "Failed to get preferences \"%s\": %d (%s)", key, err, esp_err_to_name(err));
+        return pdFALSE;
+    }
+}
+
+BaseType_t getBlobPref(nvs_handle_t pHandle, const char *key, void *value, size_t valueSize)
+{
+    size_t outValueSize = valueSize;
+    esp_err_t err = nvs_get_blob(pHandle, key, value, &outValueSize);
+    if(err == ESP_OK)
+        return pdTRUE;
+    else {
+        ESP_LOGE(TAG, "Failed to get preferences \"%s\": %d (%s)", key, err, esp_err_to_name(err));
+        return pdFALSE;
+    }
+}
+
+BaseType_t setBlobPref(nvs_handle_t pHandle, const char *key, const void *value, size_t valueSize)
+{
+    esp_err_t err = nvs_set_blob(pHandle, key, value, valueSize);
+    if(err == ESP_OK)
+        return pdTRUE;
+    else {
+        ESP_LOGE(TAG, "Failed to set preferences \"%s\": %d (%s)", key, err, esp_err_to_name(err));
+        return pdFALSE;
+    }
 }
\ No newline at end of file
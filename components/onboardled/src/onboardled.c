@@ -129,6 +129,6 @@ void onboardledInit(void){
         ESP_LOGE(TAG, "Task blinkTask not created");
     }    
 
-    ESP_ERROR_CHECK(esp_event_handler_register(ONBOARDLED_EVENT, ONBOARDLED_EVENT_SETCOLOR, &onboardLedEventHandler, NULL));
+    ESP_ERROR_CHECK(eventsHandlerRegister(ONBOARDLED_EVENT, ONBOARDLED_EVENT_SETCOLOR, &onboardLedEventHandler, NULL));
     ESP_LOGI(TAG, "OnboarLed init finish");
 }
\ No newline at end of file
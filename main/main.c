@@ -26,6 +26,7 @@ void systemInit() {
 }
 
 void app_main(void) {
+    audiomatrixRestore();
     systemInit();
     matrixLcdInit();
     lcdWriteStr("Initializing...");